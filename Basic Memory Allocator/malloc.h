@@ -7,13 +7,96 @@
  */
 
 #include <stddef.h>
+/* declare the standard functions before the macros below rename them */
+#include <stdlib.h>
 
-#define malloc(size) mymalloc(size)
+/* Requests of a compile-time constant size, such as malloc(sizeof(node_t)),
+ * get their size class from the compiler and go straight to that class's
+ * thread cache. Every other request takes the generic path.
+ */
+#define MYMALLOC_ALIGNMENT 16
+#define MYMALLOC_EXACT_CLASS_LIMIT 512
+#define MYMALLOC_CLASS_OF(size) (((size_t) (size) - 1) / MYMALLOC_ALIGNMENT)
+
+#define malloc(size) \
+  (__builtin_constant_p(size) && \
+   (size_t) (size) - 1 < MYMALLOC_EXACT_CLASS_LIMIT \
+       ? mymalloc_class(MYMALLOC_CLASS_OF(size)) : mymalloc(size))
 #define calloc(nmemb, size) mycalloc(nmemb, size)
+#define realloc(ptr, size) myrealloc(ptr, size)
 #define free(ptr) myfree(ptr)
+#define memalign(alignment, size) mymemalign(alignment, size)
+#define posix_memalign(memptr, alignment, size) myposix_memalign(memptr, alignment, size)
+#define aligned_alloc(alignment, size) myaligned_alloc(alignment, size)
+#define malloc_usable_size(ptr) mymalloc_usable_size(ptr)
 
 void *mymalloc(size_t size);
+void *mymalloc_class(unsigned index);
 void *mycalloc(size_t nmemb, size_t size);
+void *myrealloc(void *ptr, size_t size);
 void myfree(void *ptr);
+void *mymemalign(size_t alignment, size_t size);
+int myposix_memalign(void **memptr, size_t alignment, size_t size);
+void *myaligned_alloc(size_t alignment, size_t size);
+size_t mymalloc_usable_size(void *ptr);
+
+/* Slab caches for many objects of one fixed size, without a per-object
+ * header. Objects must be freed to the cache they came from.
+ */
+typedef struct slab_cache slab_cache_t;
+
+slab_cache_t *myslab_create(size_t object_size);
+void *myslab_alloc(slab_cache_t *cache);
+void myslab_free(slab_cache_t *cache, void *ptr);
+void myslab_destroy(slab_cache_t *cache);
+
+/* Regions for request-scoped work: myregion_alloc bumps a pointer through
+ * page-backed chunks, with no per-object header. Nothing is freed on its
+ * own; myregion_reset frees everything allocated from the region at once
+ * and keeps its chunks for reuse. A region is not thread-safe.
+ */
+typedef struct region region_t;
+
+region_t *myregion_create(void);
+void *myregion_alloc(region_t *region, size_t size);
+void myregion_reset(region_t *region);
+void myregion_destroy(region_t *region);
+
+/* Allocator statistics. Counters are kept per thread and added up by
+ * mymalloc_get_stats. Setting MYMALLOC_STATS=1 prints them at exit.
+ */
+#define MYMALLOC_SIZE_CLASSES 64
+
+typedef struct {
+  size_t in_use;            /* bytes in blocks the program holds */
+  size_t mapped;            /* bytes currently mapped from the os */
+  size_t free_bytes;        /* bytes in free blocks of the shared heap */
+  size_t largest_free;      /* largest of those free blocks */
+  double fragmentation;     /* 1 - largest_free / free_bytes */
+  size_t free_blocks[MYMALLOC_SIZE_CLASSES]; /* free blocks per size class */
+  unsigned long mallocs;
+  unsigned long frees;
+  unsigned long splits;
+  unsigned long coalesces;
+  unsigned long mmaps;
+  unsigned long munmaps;
+  unsigned long mremaps;
+  unsigned long lock_acquisitions;
+  unsigned long lock_contentions; /* acquisitions that had to wait */
+  unsigned long map_cache_hits;   /* large allocations reusing a cached mapping */
+  size_t map_cache_bytes;         /* bytes of freed large mappings kept for reuse */
+  unsigned long madvises;         /* madvise calls releasing empty chunk pages */
+  size_t empty_chunks;            /* completely free chunks still mapped */
+} mymalloc_stats_t;
+
+void mymalloc_get_stats(mymalloc_stats_t *stats);
+void mymalloc_print_stats(void);
+
+/* Sampling heap profiler. Setting MYMALLOC_PROFILE to a byte count (or 1
+ * for 512K) records the call stack of about one allocation per that many
+ * bytes. The live samples are written as a legacy pprof heap profile at
+ * exit, on SIGUSR2 and by this call; returns 0 or -1.
+ */
+int mymalloc_dump_profile(const char *path);
 
 #endif /* ifndef _MALLOC_H */
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // mremap
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE 
 #include <sys/mman.h>
@@ -6,27 +7,247 @@
 #include <string.h>
 #include <assert.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <limits.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/random.h>
 
 #include <debug.h> // definition of debug_printf
+#include "malloc.h"
+#include "trace.h"
 
 // each memory block on the heap uses this struct to
-// track the size of the block, its next neighbor, and whether it's free
+// track the size of the block and whether it's free. blocks in a chunk sit
+// back to back, so the next block starts right after the user data; the
+// previous block is found through the boundary tag (prev_size/prev_free)
+// that every block keeps up to date in its right neighbour's header
 typedef struct block {
+    size_t prev_size;     // size of the previous block, valid while prev_free is set
     size_t size;          // size of the user data region following this block
-    struct block *next;   // pointer to the next block in the linked list
-    int free;             // 1 = free, 0 = allocated
-} block_t;
+    unsigned char free;   // 1 = free, 0 = allocated, 2 = held in a thread cache
+    unsigned char prev_free; // 1 = the block right before this one is free
+    unsigned char mapped; // 1 = large block living in its own mmap region
+    unsigned char sampled; // 1 = recorded by the heap profiler
+    unsigned short arena; // arena whose chunk holds the block
+    unsigned owner;       // heap of the thread that allocated it, 0 = none
+    unsigned check;       // header checksum of an allocated block (hardened mode)
+} __attribute__((aligned(16))) block_t;
 
 #define BLOCK_SIZE sizeof(block_t)
+#define BLOCK_CACHED 2
 
-// global variable, head of the free list (sorted by address)
-static block_t *free_list = NULL;
+// free blocks keep their size-class links in the otherwise unused user data
+// region, which is always at least ALIGNMENT (16) bytes
+typedef struct free_links {
+    struct block *next;   // next free block in the same size class
+    struct block *prev;   // previous free block in the same size class
+} free_links_t;
+
+#define LINKS(block) ((free_links_t*)((block) + 1))
+
+// the free block covering a completely free chunk is also linked into a
+// list of empty chunks, ordered by the time they became empty. the links
+// sit in its user data right behind the size-class links
+typedef struct empty_chunk {
+    struct block *newer;  // block of the next more recently emptied chunk
+    struct block *older;
+    uint64_t since;       // when the chunk became empty, in milliseconds
+    int purged;           // its inner pages were released with madvise
+} empty_chunk_t;
+
+#define EMPTY(block) ((empty_chunk_t*)(LINKS(block) + 1))
+
+// small blocks are carved out of chunks mapped with one mmap call each. by
+// default a chunk is a single page; setting MYMALLOC_ARENA_SIZE (e.g. "4M")
+// switches to arena mode with chunks of that many bytes (page multiple, up
+// to 64 MiB). a chunk is [chunk_t][blocks...][epilogue block_t]: the first
+// block never has a free predecessor and the allocated, zero-sized epilogue
+// stops coalescing at the end, so a chunk whose payload is one free block
+// again can be unmapped
+typedef struct chunk {
+    size_t size;          // length of the whole mapping
+} __attribute__((aligned(16))) chunk_t;
+
+#define CHUNK_HEADER_SIZE sizeof(chunk_t)
+#define MAX_ARENA_SIZE (64UL << 20)
+
+// completely free chunks that never decay, and the most chunks one call of
+// decay_empty_chunks purges or unmaps
+#define MAX_EMPTY_CHUNKS 2
+#define DECAY_BATCH 32
+
+// requests are rounded up to a multiple of ALIGNMENT bytes
+#define ALIGNMENT MYMALLOC_ALIGNMENT
+
+// free blocks are kept in segregated lists, one per size class. sizes up to
+// EXACT_CLASS_LIMIT get their own 16-byte class, above that every class
+// covers one power of two. class_bitmap has bit i set when class i is
+// non-empty so the first usable class is found without walking empty lists
+#define NUM_CLASSES MYMALLOC_SIZE_CLASSES
+#define EXACT_CLASS_LIMIT MYMALLOC_EXACT_CLASS_LIMIT
+
+// blocks looked at in the request's own class before moving to a higher one
+#define CLASS_SEARCH_LIMIT 8
+
+// the shared heap is split into arenas, one per numa node, each with its
+// own lock, free lists and empty chunks. a thread allocates from the arena
+// of the node it is running on, and the chunks of an arena are bound to its
+// node with mbind, so small blocks are local to the thread that asked for
+// them. a block is always freed back into the arena of its chunk. on a
+// single-node machine there is one arena; MYMALLOC_ARENAS=n forces n arenas
+// (without mbind) with threads spread over them by heap slot, so the
+// multi-arena paths can be tested anywhere
+#define MAX_ARENAS 16
+
+typedef struct arena {
+    pthread_mutex_t lock;
+    block_t *size_classes[NUM_CLASSES]; // heads of the segregated free lists
+    uint64_t class_bitmap;              // ... and their occupancy bitmap
+    size_t empty_chunks;                // completely free chunks in the lists
+    block_t *empty_newest;              // ... and the ends of their list
+    block_t *empty_oldest;
+} __attribute__((aligned(64))) arena_t;
+
+static arena_t arenas[MAX_ARENAS] = {
+    [0 ... MAX_ARENAS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+// store the number of arenas (0 until read) and whether they follow real
+// numa nodes
+static unsigned NUM_ARENAS = 0;
+static int NUMA_NODES = 0;
+
+// per-thread caches of recently freed blocks, one stack per exact size class
+// (sizes up to EXACT_CLASS_LIMIT). they serve most small requests without
+// touching an arena lock and move blocks to/from the arenas in batches
+#define TCACHE_CLASSES (EXACT_CLASS_LIMIT / ALIGNMENT)
+#define TCACHE_MAX 32     // cached blocks per class before a flush
+#define TCACHE_BATCH 16   // blocks moved per refill/flush
+
+// statistics are counted per thread without atomics or locks and only
+// added up when they are read
+enum {
+    STAT_ALLOCATED,       // bytes handed to the program
+    STAT_RELEASED,        // bytes given back by the program
+    STAT_MAPPED,          // bytes obtained with mmap (and mremap growth)
+    STAT_UNMAPPED,        // bytes returned with munmap (and mremap shrinking)
+    STAT_MALLOCS,
+    STAT_FREES,
+    STAT_SPLITS,
+    STAT_COALESCES,
+    STAT_MMAPS,
+    STAT_MUNMAPS,
+    STAT_MREMAPS,
+    STAT_LOCKS,           // arena lock acquisitions
+    STAT_CONTENDED,       // ... that had to wait for another thread
+    STAT_MAP_CACHE_HITS,  // large allocations served from the mapping cache
+    STAT_MADVISES,        // madvise calls releasing pages of empty chunks
+    STAT_COUNT
+};
+
+typedef struct {
+    block_t *blocks[TCACHE_CLASSES]; // stacks linked through LINKS(block)->next
+    unsigned count[TCACHE_CLASSES];
+    int registered;                  // exit destructor installed
+    int exited;                      // exit destructor ran, cache bypassed
+    unsigned id;                     // owned heap slot, 0 = none
+    unsigned long stats[STAT_COUNT]; // this thread's share of the statistics
+    long sample_left;                // bytes until the next profile sample
+    unsigned long sample_random;     // sampling random state, 0 = unseeded
+    int in_profiler;                 // allocations made by the profiler itself
+    void *profile_caller;            // where the program called in, or NULL
+    struct trace_buffer *trace;      // records not yet written to the trace
+    unsigned trace_thread;           // thread number in the trace
+    int in_tracer;                   // inside a traced call, don't record again
+} tcache_t;
+
+// initial-exec keeps TLS access free of allocations when built as a
+// preloaded shared library
+static __thread tcache_t tcache __attribute__((tls_model("initial-exec")));
+
+// cached-size blocks remember which thread's heap allocated them. a block
+// freed by another thread is pushed onto its owner's lock-free MPSC list
+// instead of the freeing thread's cache, and the owner drains that list into
+// its cache on its next allocation, so producer/consumer pairs never meet on
+// an arena lock. slots are numbered 1..MAX_HEAPS and reused once a thread
+// exits; threads beyond MAX_HEAPS own nothing and use the shared heap
+#define MAX_HEAPS 256
+
+typedef struct {
+    block_t *remote;  // blocks freed by other threads, linked through LINKS(block)->next
+    int in_use;       // a live thread owns this slot
+    unsigned long *stats; // the owner's counters, guarded by stats_lock
+} __attribute__((aligned(64))) heap_slot_t;
+
+static heap_slot_t heaps[MAX_HEAPS];
+
+// counters of threads that exited (or never got a heap slot, once they
+// exit) and the lock that keeps readers off counters of exiting threads
+static unsigned long retired_stats[STAT_COUNT];
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// count into this thread's statistics. the owner is the only writer, the
+// relaxed store only keeps concurrent readers well-defined
+#define STAT_ADD(stat, n) \
+    __atomic_store_n(&tcache.stats[stat], tcache.stats[stat] + (n), __ATOMIC_RELAXED)
+#define STAT_INC(stat) STAT_ADD(stat, 1)
+
+// flushes a thread's cache back to the shared heap when the thread exits
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
 
 // store system page size
 static size_t PAGE_SIZE = 0;
 
-// mutex for thread-safety
-static pthread_mutex_t malloc_lock = PTHREAD_MUTEX_INITIALIZER;
+// store chunk size (page size unless MYMALLOC_ARENA_SIZE is set)
+static size_t ARENA_SIZE = 0;
+
+// helper: take an arena's lock, counting acquisitions that had to wait
+static inline void lock_heap(arena_t *arena) {
+    if (pthread_mutex_trylock(&arena->lock) != 0) {
+        STAT_INC(STAT_CONTENDED);
+        pthread_mutex_lock(&arena->lock);
+    }
+    STAT_INC(STAT_LOCKS);
+}
+
+// helper: release an arena's lock
+static inline void unlock_heap(arena_t *arena) {
+    pthread_mutex_unlock(&arena->lock);
+}
+
+// helper: the arena a free block of the shared heap belongs to
+static inline arena_t *block_arena(block_t *block) {
+    return &arenas[block->arena];
+}
+
+// helper: map length bytes of fresh memory, NULL on failure
+static void *map_pages(size_t length) {
+    void *ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+    STAT_INC(STAT_MMAPS);
+    STAT_ADD(STAT_MAPPED, length);
+    return ptr;
+}
+
+// helper: give length bytes at addr back to the os
+static void unmap_pages(void *addr, size_t length) {
+    STAT_INC(STAT_MUNMAPS);
+    STAT_ADD(STAT_UNMAPPED, length);
+    munmap(addr, length);
+}
 
 // helper to get system page size
 static inline size_t get_page_size() {
@@ -37,286 +258,2575 @@ static inline size_t get_page_size() {
     return PAGE_SIZE;
 }
 
-// helper function to determine if a request size is "small"
-int is_small_block(size_t size) {
-    return size < get_page_size() - BLOCK_SIZE;
+// helper: parse a byte count with an optional K, M or G suffix
+static size_t parse_size(const char *text) {
+    char *end;
+    size_t value = strtoul(text, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': value <<= 10; // fall through
+        case 'M': case 'm': value <<= 10; // fall through
+        case 'K': case 'k': value <<= 10;
+    }
+    return value;
 }
 
-// helper: insert block into free list sorted by address and coalesce adjacent blocks
-// prints coalesce debug messages as required
-void insert_into_free_list(block_t *block) {
-    assert(block != NULL);
-    block->free = 1;
+// helper to get chunk size, reading MYMALLOC_ARENA_SIZE on first use
+static inline size_t get_arena_size() {
+    if (ARENA_SIZE == 0) {
+        size_t page_size = get_page_size();
+        size_t size = page_size;
+        const char *env = getenv("MYMALLOC_ARENA_SIZE");
+        if (env != NULL) {
+            size = parse_size(env);
+            size = (size + page_size - 1) / page_size * page_size;
+            if (size < page_size) size = page_size;
+            if (size > MAX_ARENA_SIZE) size = MAX_ARENA_SIZE;
+        }
+        ARENA_SIZE = size;
+    }
+    return ARENA_SIZE;
+}
+
+// transparent huge pages: with MYMALLOC_HUGEPAGES=1, mappings of at least
+// HUGE_PAGE_SIZE (large blocks, and arena chunks of 2M or more) start on a
+// huge page boundary and are marked MADV_HUGEPAGE, so the kernel can back
+// them with 2 MiB pages and scans over big arrays take fewer TLB misses.
+// the option stays off when the kernel has no THP support or has it set to
+// "never"; a failing madvise is ignored since the mapping works either way
+#define HUGE_PAGE_SIZE (2UL << 20)
+#define THP_SETTING "/sys/kernel/mm/transparent_hugepage/enabled"
+
+// store whether huge pages are used (-1 until MYMALLOC_HUGEPAGES is read)
+static int HUGE_PAGES = -1;
+
+// helper to get the huge page option, reading MYMALLOC_HUGEPAGES and the
+// kernel's THP setting on first use. plain open/read, since stdio may
+// allocate
+static inline int get_huge_pages() {
+    if (HUGE_PAGES == -1) {
+        int enabled = 0;
+        const char *env = getenv("MYMALLOC_HUGEPAGES");
+        if (env != NULL && atoi(env) != 0) {
+            char setting[64] = "";
+            int fd = open(THP_SETTING, O_RDONLY | O_CLOEXEC);
+            if (fd >= 0) {
+                ssize_t n = read(fd, setting, sizeof(setting) - 1);
+                setting[n > 0 ? n : 0] = '\0';
+                close(fd);
+                enabled = strstr(setting, "[never]") == NULL;
+            }
+        }
+        HUGE_PAGES = enabled;
+    }
+    return HUGE_PAGES;
+}
+
+// helper: map length bytes like map_pages, but when huge pages are on and
+// the mapping can hold one, start it on a huge page boundary and ask for
+// huge pages. the tail past the last whole huge page stays in small pages
+static void *map_huge_pages(size_t length) {
+    if (length < HUGE_PAGE_SIZE || !get_huge_pages()) {
+        return map_pages(length);
+    }
+    size_t extra = HUGE_PAGE_SIZE - get_page_size();
+    char *ptr = map_pages(length + extra);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    char *start = (char*)(((uintptr_t)ptr + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (start > ptr) {
+        unmap_pages(ptr, start - ptr);
+    }
+    if (start < ptr + extra) {
+        unmap_pages(start + length, ptr + extra - start);
+    }
+    madvise(start, length, MADV_HUGEPAGE);
+    return start;
+}
+
+// helper: highest node number in a sysfs node list like "0" or "0-1,3",
+// -1 if it can't be read. plain open/read, since stdio may allocate
+static int max_node(const char *path) {
+    char list[128] = "";
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, list, sizeof(list) - 1);
+    close(fd);
+    list[n > 0 ? n : 0] = '\0';
+
+    int highest = -1;
+    for (char *p = list; *p != '\0'; ) {
+        char *end;
+        long node = strtol(p, &end, 10);
+        if (end == p) {
+            p++;
+        } else {
+            highest = node > highest ? node : highest;
+            p = end;
+        }
+    }
+    return highest;
+}
+
+// helper to get the number of arenas, reading MYMALLOC_ARENAS and the
+// online numa nodes on first use
+static inline unsigned get_num_arenas() {
+    if (NUM_ARENAS == 0) {
+        unsigned count = 1;
+        const char *env = getenv("MYMALLOC_ARENAS");
+        if (env != NULL) {
+            count = atoi(env) > 0 ? atoi(env) : 1;
+        } else {
+            int highest = max_node("/sys/devices/system/node/online");
+            if (highest > 0) {
+                count = highest + 1;
+                NUMA_NODES = 1;
+            }
+        }
+        NUM_ARENAS = count < MAX_ARENAS ? count : MAX_ARENAS;
+    }
+    return NUM_ARENAS;
+}
+
+// helper: the arena the calling thread allocates from. with numa nodes this
+// is the node of the cpu it is running on right now (getcpu is a vdso call)
+static inline arena_t *thread_arena(void) {
+    unsigned count = get_num_arenas();
+    if (count == 1) {
+        return &arenas[0];
+    }
+    unsigned node = tcache.id;
+    if (NUMA_NODES) {
+        unsigned cpu;
+        getcpu(&cpu, &node);
+    }
+    return &arenas[node % count];
+}
 
-    // if free list empty, insert as head
-    if (free_list == NULL) {
-        free_list = block;
-        block->next = NULL;
+// helper: ask the kernel to place a fresh mapping on an arena's node.
+// MPOL_PREFERRED falls back to other nodes when that one is full
+static void bind_to_node(void *addr, size_t length, unsigned node) {
+    if (!NUMA_NODES) {
         return;
     }
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, addr, length, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+}
+
+// helper: size of the single free block covering a whole, unused chunk
+static inline size_t chunk_payload_size() {
+    return get_arena_size() - CHUNK_HEADER_SIZE - 2 * BLOCK_SIZE;
+}
+
+// hardened mode, for running a share of production hosts with heap
+// corruption checks. MYMALLOC_HARDEN=1 seals the header of every block
+// handed out with a keyed checksum and puts a canary in the last 8 bytes of
+// its user data, both verified when the block comes back; it also stores
+// free-list links xor-ed with a secret key and their own address, so an
+// overflow into a free block cannot plant a usable pointer.
+// MYMALLOC_HARDEN=guard adds a PROT_NONE guard page behind every large
+// block. a failed check prints what went wrong and aborts
+#define HARDEN_CHECKS 1
+#define HARDEN_GUARD 2
+#define CANARY_SIZE sizeof(uint64_t)
+
+// store the hardening level and the secret key, both set once by
+// harden_init before the first block is handed out
+static int HARDEN = 0;
+static uintptr_t HARDEN_KEY = 0;
+static pthread_once_t harden_once = PTHREAD_ONCE_INIT;
 
-    // find insertion point (keep list sorted by address)
-    if (block < free_list) {
-        block->next = free_list;
-        
-        // Attempt coalescing with next
-        if ((char*)block + BLOCK_SIZE + block->size == (char*)free_list) {
-            size_t old_block_size = block->size;
-            size_t old_next_size = free_list->size;
-            size_t new_size = block->size + BLOCK_SIZE + free_list->size;
-            debug_printf("free: coalesce blocks of size %zu and %zu to new block of size %zu\n",
-                        old_block_size, old_next_size, new_size);
-            block->size = new_size;
-            block->next = free_list->next;
-        }
-        free_list = block;
+// helper: read MYMALLOC_HARDEN and pick a random key. must not allocate
+static void harden_init(void) {
+    const char *env = getenv("MYMALLOC_HARDEN");
+    if (env == NULL) {
         return;
     }
+    HARDEN = strcmp(env, "guard") == 0 ? HARDEN_GUARD : atoi(env) != 0 ? HARDEN_CHECKS : 0;
+    uintptr_t key = 0;
+    if (getrandom(&key, sizeof(key), GRND_NONBLOCK) != sizeof(key)) {
+        key = ((uintptr_t)&key ^ time(NULL) ^ getpid()) * 0x9E3779B97F4A7C15UL;
+    }
+    HARDEN_KEY = key | 1;
+}
 
-    // find insertion point (keep list sorted by address)
-    block_t *current = free_list;
-    while (current->next != NULL && current->next < block) {
-        current = current->next;
+// helper: report heap corruption found at block and abort. plain write,
+// since stdio may allocate
+static void harden_abort(const char *what, void *block) {
+    char line[128] = "mymalloc: ";
+    size_t n = strlen(line);
+    while (*what != '\0' && n < sizeof(line) - 24) {
+        line[n++] = *what++;
     }
+    memcpy(line + n, " at 0x", 6);
+    n += 6;
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        line[n++] = "0123456789abcdef"[((uintptr_t)block >> shift) & 15];
+    }
+    line[n++] = '\n';
+    ssize_t written = write(STDERR_FILENO, line, n);
+    (void)written;
+    abort();
+}
 
-    // insert between current and current->next
-    block->next = current->next;
-    current->next = block;
+// helper: store a free-list link at field, encoded in hardened mode
+static inline void link_set(block_t **field, block_t *value) {
+    if (HARDEN) {
+        value = (block_t*)((uintptr_t)value ^ HARDEN_KEY ^ ((uintptr_t)field >> 12));
+    }
+    *field = value;
+}
 
-    // Attempt coalescing with next
-    if (block->next != NULL && 
-        (char*)block + BLOCK_SIZE + block->size == (char*)block->next) {
-        size_t old_block_size = block->size;
-        size_t old_next_size = block->next->size;
-        size_t new_size = block->size + BLOCK_SIZE + block->next->size;
-        debug_printf("free: coalesce blocks of size %zu and %zu to new block of size %zu\n",
-                    old_block_size, old_next_size, new_size);
-        block->size = new_size;
-        block->next = block->next->next;
+// helper: load a free-list link stored with link_set. a decoded link that
+// is not block-aligned means the free block was overwritten
+static inline block_t *link_get(block_t *const *field) {
+    block_t *value = *field;
+    if (HARDEN) {
+        value = (block_t*)((uintptr_t)value ^ HARDEN_KEY ^ ((uintptr_t)field >> 12));
+        if ((uintptr_t)value % ALIGNMENT != 0) {
+            harden_abort("corrupted free list", (void*)field);
+        }
     }
+    return value;
+}
 
-    // Attempt coalescing with previous (current)
-    if ((char*)current + BLOCK_SIZE + current->size == (char*)block) {
-        size_t old_current_size = current->size;
-        size_t old_block_size = block->size;
-        size_t new_size = current->size + BLOCK_SIZE + block->size;
-        debug_printf("free: coalesce blocks of size %zu and %zu to new block of size %zu\n",
-                    old_current_size, old_block_size, new_size);
-        current->size = new_size;
-        current->next = block->next;
+// helper: keyed checksum of the header fields that stay fixed while a block
+// is allocated
+static inline unsigned header_checksum(block_t *block) {
+    uint64_t x = ((uintptr_t)block ^ HARDEN_KEY) * 0x9E3779B97F4A7C15UL;
+    x = (x ^ block->size) * 0xBF58476D1CE4E5B9UL;
+    x = (x ^ ((uint64_t)block->owner << 24) ^ ((uint64_t)block->arena << 8) ^ block->mapped)
+        * 0x94D049BB133111EBUL;
+    return (unsigned)(x >> 32);
+}
+
+// helper: the canary in the last bytes of a block's user data
+static inline uint64_t *canary_slot(block_t *block) {
+    return (uint64_t*)((char*)(block + 1) + block->size - CANARY_SIZE);
+}
+
+// helper: bytes a request needs in hardened mode, before rounding
+static inline size_t harden_extra() {
+    return HARDEN ? CANARY_SIZE : 0;
+}
+
+// helper: length of the guard page behind a large block, 0 if none
+static inline size_t guard_size() {
+    return HARDEN == HARDEN_GUARD ? get_page_size() : 0;
+}
+
+// helper: hand a block to the program, sealing its header and writing its
+// canary in hardened mode
+static inline void *harden_seal(block_t *block) {
+    if (HARDEN) {
+        block->check = header_checksum(block);
+        *canary_slot(block) = HARDEN_KEY ^ (uintptr_t)block;
     }
+    return (void*)(block + 1);
 }
 
-// helper function, find_free_block
-// purpose, traverse the free list to locate the first free block large enough
-// to hold size bytes
-block_t *find_and_remove_free_block(size_t size) {
-    block_t *prev = NULL;
-    block_t *current = free_list;
-
-    // traverse the free list until a usable free block is found
-    while (current != NULL) {
-        if (current->size >= size) {
-            // remove from free list
-            if (prev == NULL) {
-                free_list = current->next;
-            } else {
-                prev->next = current->next;
-            }
-            current->free = 0;
-            current->next = NULL;
-            debug_printf("malloc: block of size %zu found\n", current->size);
-            return current;
+// helper: verify a block the program passed back, in hardened mode
+static inline void harden_check(block_t *block) {
+    if (!HARDEN) {
+        return;
+    }
+    if (block->free != 0) {
+        harden_abort("double free", block + 1);
+    }
+    if (block->check != header_checksum(block)) {
+        harden_abort("invalid pointer or corrupted block header", block + 1);
+    }
+    if (*canary_slot(block) != (HARDEN_KEY ^ (uintptr_t)block)) {
+        harden_abort("heap buffer overflow", block + 1);
+    }
+}
+
+// helper: round a request up to the allocator's alignment
+static inline size_t align_size(size_t size) {
+    return (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+}
+
+// helper: map a block size to the index of its size class
+static inline unsigned size_class(size_t size) {
+    if (size <= EXACT_CLASS_LIMIT) {
+        return size == 0 ? 0 : (size - 1) / ALIGNMENT;
+    }
+    // 513..1024 -> first power-of-two class, 1025..2048 -> next, ...
+    unsigned log2 = 63 - __builtin_clzl(size - 1);
+    unsigned index = EXACT_CLASS_LIMIT / ALIGNMENT + log2 - 9;
+    return index < NUM_CLASSES ? index : NUM_CLASSES - 1;
+}
+
+// helper: push a free block onto the list of its size class
+static void class_insert(block_t *block) {
+    arena_t *arena = block_arena(block);
+    unsigned index = size_class(block->size);
+    free_links_t *links = LINKS(block);
+    block_t *next = arena->size_classes[index];
+    link_set(&links->prev, NULL);
+    link_set(&links->next, next);
+    if (next != NULL) {
+        link_set(&LINKS(next)->prev, block);
+    }
+    arena->size_classes[index] = block;
+    arena->class_bitmap |= 1UL << index;
+}
+
+// helper: unlink a free block from the list of its size class
+static void class_remove(block_t *block) {
+    arena_t *arena = block_arena(block);
+    unsigned index = size_class(block->size);
+    free_links_t *links = LINKS(block);
+    block_t *prev = link_get(&links->prev);
+    block_t *next = link_get(&links->next);
+    if (HARDEN && ((prev != NULL && link_get(&LINKS(prev)->next) != block) ||
+                   (next != NULL && link_get(&LINKS(next)->prev) != block))) {
+        harden_abort("corrupted free list", block);
+    }
+    if (prev != NULL) {
+        link_set(&LINKS(prev)->next, next);
+    } else {
+        arena->size_classes[index] = next;
+        if (next == NULL) {
+            arena->class_bitmap &= ~(1UL << index);
         }
-        prev = current;
-        current = current->next;
     }
+    if (next != NULL) {
+        link_set(&LINKS(next)->prev, prev);
+    }
+}
 
-    // no suitable free block found
-    return NULL;
+// helper: the block physically following this one in its chunk
+static inline block_t *next_block(block_t *block) {
+    return (block_t*)((char*)(block + 1) + block->size);
 }
 
-// add_more_space helper
-// request new memory from the os using mmap when no existing
-// free block can satisfy the request arguments
-block_t *allocate_new_page(void) {
-    size_t page_size = get_page_size();
+// helper: the block physically preceding this one (only valid if prev_free)
+static inline block_t *prev_block(block_t *block) {
+    return (block_t*)((char*)block - block->prev_size - BLOCK_SIZE);
+}
 
-    // for small blocks, allocate one page with mmap
-    void *ptr = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
-                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (ptr == MAP_FAILED) return NULL;
+// helper: publish a block's state in its right neighbour's boundary tag
+static inline void set_boundary_tag(block_t *block) {
+    block_t *next = next_block(block);
+    next->prev_free = block->free == 1;
+    next->prev_size = block->size;
+}
 
-    block_t *block = (block_t*)ptr;
-    block->size = page_size - BLOCK_SIZE;
-    block->next = NULL;
-    block->free = 0;
+// helper function to determine if a request size is "small", i.e. fits in
+// a one-page chunk. larger requests get their own mapping
+int is_small_block(size_t size) {
+    return size <= get_page_size() - CHUNK_HEADER_SIZE - 2 * BLOCK_SIZE;
+}
 
-    return block;
+// helper: first byte of the mapping holding a large block. a large block
+// ends at the end of its mapping but, if it is aligned, may start part way
+// into the first page
+static inline void *mapping_start(block_t *block) {
+    return (void*)((uintptr_t)block & ~(uintptr_t)(get_page_size() - 1));
 }
 
-// mymalloc
-// allocate a block of memory of size s bytes,
-// prints "malloc %zu bytes\n" for debugging
-void *mymalloc(size_t s) {
-    debug_printf("Malloc %zu bytes\n", s);
+// helper: length of the mapping holding a large block
+static inline size_t mapping_length(block_t *block) {
+    return (char*)(block + 1) + block->size + guard_size() - (char*)mapping_start(block);
+}
 
-    // reject zero-byte allocations
-    if (s == 0) {
-        return NULL;
-    }
+// memory the program gave back is not returned to the os right away but
+// decays: empty chunks and cached large mappings are released once they
+// sat unused for MYMALLOC_DECAY_MS milliseconds (default 1000, 0 releases
+// at once). MYMALLOC_PURGE=free makes the first release step of a chunk use
+// MADV_FREE instead of MADV_DONTNEED, which is cheaper but leaves the pages
+// counted in the rss until the kernel needs them
+#define DEFAULT_DECAY_MS 1000
 
-    // lock for thread-safety of free_list and allocator state
-    pthread_mutex_lock(&malloc_lock);
+// store the decay time (UINT64_MAX until MYMALLOC_DECAY_MS is read)
+static uint64_t DECAY_MS = UINT64_MAX;
 
-    block_t *block = NULL;
-    size_t page_size = get_page_size();
+// store the madvise advice that releases the pages of empty chunks
+static int PURGE_ADVICE = -1;
 
-    // For small requests, try free list first
-    if (is_small_block(s)) {
-        block = find_and_remove_free_block(s);
-        if (block == NULL) {
-            debug_printf("malloc: block of size %zu not found - calling mmap\n", s);
-            block = allocate_new_page();
-            if (block == NULL) {
-                pthread_mutex_unlock(&malloc_lock);
-                return NULL;
-            }
+// helper: coarse monotonic clock in milliseconds, cheap enough to read on
+// every cache operation
+static inline uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// helper to get the decay time, reading MYMALLOC_DECAY_MS on first use.
+// longer times are clamped so twice the decay time (when empty chunks are
+// unmapped) cannot overflow; that is still forever
+static inline uint64_t get_decay_ms() {
+    if (DECAY_MS == UINT64_MAX) {
+        const char *env = getenv("MYMALLOC_DECAY_MS");
+        uint64_t decay = env != NULL ? strtoull(env, NULL, 10) : DEFAULT_DECAY_MS;
+        DECAY_MS = decay < UINT64_MAX / 2 ? decay : UINT64_MAX / 2;
+    }
+    return DECAY_MS;
+}
+
+// helper to get the purge advice, reading MYMALLOC_PURGE on first use
+static inline int get_purge_advice() {
+    if (PURGE_ADVICE == -1) {
+        int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+        const char *env = getenv("MYMALLOC_PURGE");
+        if (env != NULL && strcmp(env, "free") == 0) {
+            advice = MADV_FREE;
         }
+#endif
+        PURGE_ADVICE = advice;
+    }
+    return PURGE_ADVICE;
+}
 
-        // if the new page is larger than requested, consider splitting
-        if (block->size > s) {
-            size_t original_size = block->size;
-            size_t leftover = original_size - s;
-            if (leftover >= (BLOCK_SIZE + BLOCK_SIZE)) {
-                // split: allocated part remains at start, leftover becomes a free block
-                block_t *leftover_block = (block_t*)((char*)(block + 1) + s);
-                leftover_block->size = leftover - BLOCK_SIZE;
-                leftover_block->next = NULL;
-                leftover_block->free = 1;
+// freed large mappings are kept in a bounded cache and handed out again
+// before new memory is mapped, which saves the mmap/munmap pair and the page
+// faults on pages that were already touched. the entry lives at the start of
+// the cached mapping itself. entries are bucketed by the log2 of their page
+// count and also linked by age, so the cache can be trimmed: a mapping goes
+// back to the os once it sat unused for the decay time, or when keeping
+// another one would exceed MYMALLOC_MAP_CACHE bytes (default 64M, 0 turns
+// the cache off). both limits are checked whenever the cache is used
+typedef struct cached_mapping {
+    struct cached_mapping *next;   // same bucket, newest first
+    struct cached_mapping *prev;
+    struct cached_mapping *newer;  // all entries, by the time they were freed
+    struct cached_mapping *older;
+    size_t length;                 // length of the whole mapping
+    uint64_t freed_at;             // coarse monotonic time in milliseconds
+} cached_mapping_t;
 
-                block->size = s;
-                block->free = 0;
+#define MAP_CACHE_BUCKETS 64
+#define MAP_CACHE_DEFAULT (64UL << 20)
 
-                insert_into_free_list(leftover_block);
+static cached_mapping_t *map_cache[MAP_CACHE_BUCKETS];
+static cached_mapping_t *map_cache_newest = NULL;
+static cached_mapping_t *map_cache_oldest = NULL;
+static size_t map_cache_bytes = 0;
+static pthread_mutex_t map_cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
-                debug_printf("malloc: splitting - blocks of size %zu and %zu created\n",
-                            block->size, leftover_block->size);
-            }
-        }
+// store the cache limit in bytes (SIZE_MAX until MYMALLOC_MAP_CACHE is read)
+static size_t MAP_CACHE_LIMIT = SIZE_MAX;
 
-        void *user_ptr = (void*)(block + 1);
-        pthread_mutex_unlock(&malloc_lock);
-        return user_ptr;
-    } else {
-        // Large allocation: use mmap for exact number of pages required
-        size_t num_pages = (s + BLOCK_SIZE + page_size - 1) / page_size;
-        size_t total_size = num_pages * page_size;
-        debug_printf("malloc: large block - mmap region of size %zu\n", total_size);
+// helper to get the cache limit, reading MYMALLOC_MAP_CACHE on first use
+static inline size_t get_map_cache_limit() {
+    if (MAP_CACHE_LIMIT == SIZE_MAX) {
+        const char *env = getenv("MYMALLOC_MAP_CACHE");
+        MAP_CACHE_LIMIT = env != NULL ? parse_size(env) : MAP_CACHE_DEFAULT;
+    }
+    return MAP_CACHE_LIMIT;
+}
 
-        void *ptr = mmap(NULL, total_size, PROT_READ | PROT_WRITE,
-                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (ptr == MAP_FAILED) {
-            pthread_mutex_unlock(&malloc_lock);
-            return NULL;
-        }
+// helper: bucket of a cached mapping of length bytes
+static inline unsigned map_bucket(size_t length) {
+    return 63 - __builtin_clzl(length / get_page_size());
+}
 
-        block = (block_t*)ptr;
-        block->size = total_size - BLOCK_SIZE;
-        block->next = NULL;
-        block->free = 0;
+// helper: unlink a cached mapping, under map_cache_lock
+static void map_cache_remove(cached_mapping_t *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        map_cache[map_bucket(entry->length)] = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    }
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        map_cache_newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        map_cache_oldest = entry->newer;
+    }
+    map_cache_bytes -= entry->length;
+}
 
-        void *user_ptr = (void*)(block + 1);
-        pthread_mutex_unlock(&malloc_lock);
-        return user_ptr;
+// helper: unlink the mappings that decayed, and the oldest ones until extra
+// more bytes fit under the limit, under map_cache_lock. returns them linked
+// through next so they can be unmapped after the lock is dropped
+static cached_mapping_t *map_cache_trim(size_t extra, uint64_t now) {
+    size_t limit = get_map_cache_limit();
+    uint64_t decay = get_decay_ms();
+    cached_mapping_t *victims = NULL;
+    while (map_cache_oldest != NULL &&
+           (map_cache_bytes + extra > limit ||
+            now - map_cache_oldest->freed_at >= decay)) {
+        cached_mapping_t *entry = map_cache_oldest;
+        map_cache_remove(entry);
+        entry->next = victims;
+        victims = entry;
     }
+    return victims;
 }
 
-// mycalloc
-// allocate and zero-initialize an array of nmemb elements of size s
-// arguments, prints "calloc %zu bytes\n" for debugging
-void *mycalloc(size_t nmemb, size_t s) {
-    size_t total_size = nmemb * s;
+// helper: unmap the mappings returned by map_cache_trim
+static void map_cache_release(cached_mapping_t *victims) {
+    while (victims != NULL) {
+        cached_mapping_t *next = victims->next;
+        debug_printf("map cache: munmap region of size %zu\n", victims->length);
+        unmap_pages(victims, victims->length);
+        victims = next;
+    }
+}
 
-    // detect potential overflow in multiplication
-    if (nmemb != 0 && total_size / nmemb != s) {
-        return NULL;
+// helper: keep a freed large mapping for reuse, or unmap it if it can't be
+// cached
+static void map_cache_put(void *start, size_t length) {
+    if (length > get_map_cache_limit()) {
+        debug_printf("free: munmap region of size %zu\n", length);
+        unmap_pages(start, length);
+        return;
     }
+    debug_printf("free: cache region of size %zu\n", length);
 
-    debug_printf("Calloc %zu bytes\n", total_size);
+    cached_mapping_t *entry = start;
+    unsigned bucket = map_bucket(length);
+    entry->length = length;
+    entry->freed_at = now_ms();
 
-    // allocate memory using mymalloc (which is thread-safe)
-    void *ptr = mymalloc(total_size);
-    if (ptr == NULL) return NULL;
+    pthread_mutex_lock(&map_cache_lock);
+    cached_mapping_t *victims = map_cache_trim(length, entry->freed_at);
+    entry->prev = NULL;
+    entry->next = map_cache[bucket];
+    if (entry->next != NULL) {
+        entry->next->prev = entry;
+    }
+    map_cache[bucket] = entry;
+    entry->newer = NULL;
+    entry->older = map_cache_newest;
+    if (entry->older != NULL) {
+        entry->older->newer = entry;
+    } else {
+        map_cache_oldest = entry;
+    }
+    map_cache_newest = entry;
+    map_cache_bytes += length;
+    pthread_mutex_unlock(&map_cache_lock);
 
-    // zero only the user region (mmap'd pages are already zeroed, but safe to memset)
-    memset(ptr, 0, total_size);
+    map_cache_release(victims);
+}
 
-    return ptr;
+// helper: take the best-fitting cached mapping of at least length and less
+// than twice length bytes, which lives in length's bucket or the one above,
+// and unmap its pages past length. NULL if there is none
+static void *map_cache_get(size_t length) {
+    if (get_map_cache_limit() == 0) {
+        return NULL;
+    }
+    uint64_t now = now_ms();
+
+    pthread_mutex_lock(&map_cache_lock);
+    cached_mapping_t *victims = map_cache_trim(0, now);
+    cached_mapping_t *best = NULL;
+    unsigned bucket = map_bucket(length);
+    for (unsigned i = bucket; i <= bucket + 1 && i < MAP_CACHE_BUCKETS && best == NULL; i++) {
+        for (cached_mapping_t *entry = map_cache[i]; entry != NULL; entry = entry->next) {
+            if (entry->length >= length && entry->length < 2 * length &&
+                (best == NULL || entry->length < best->length)) {
+                best = entry;
+                if (entry->length == length) {
+                    break;
+                }
+            }
+        }
+    }
+    if (best != NULL) {
+        map_cache_remove(best);
+    }
+    pthread_mutex_unlock(&map_cache_lock);
+
+    map_cache_release(victims);
+    if (best == NULL) {
+        return NULL;
+    }
+    STAT_INC(STAT_MAP_CACHE_HITS);
+    if (best->length > length) {
+        unmap_pages((char*)best + length, best->length - length);
+    }
+    return best;
 }
 
-// myfree
-// mark a previously allocated block as free and available for reuse
-void myfree(void *ptr) {
+// helper: map a large block of (aligned) size s whose user data is aligned
+// to alignment bytes. the mapping is only as large as the worst-case
+// misalignment needs, and the whole pages in front of the header and
+// behind the data are unmapped again
+static block_t *map_large_block(size_t s, size_t alignment) {
+    size_t page_size = get_page_size();
+    size_t guard = guard_size();
+    s += guard;
+    size_t num_pages = (s + BLOCK_SIZE + alignment - ALIGNMENT + page_size - 1) / page_size;
+    size_t total_size = num_pages * page_size;
+    char *ptr = map_cache_get(total_size);
     if (ptr == NULL) {
-        return; // no-op on null pointer
+        debug_printf("malloc: large block - mmap region of size %zu\n", total_size);
+        ptr = map_huge_pages(total_size);
+        if (ptr == NULL) {
+            return NULL;
+        }
+    } else {
+        debug_printf("malloc: large block - reuse cached region of size %zu\n", total_size);
     }
 
-    // get block metadata (stored immediately before the user data)
-    block_t *block = (block_t*)ptr - 1;
-    
-    // prevent double free, block should not already be marked free
-    assert(block->free == 0);
+    uintptr_t user = ((uintptr_t)ptr + BLOCK_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    char *start = (char*)((user - BLOCK_SIZE) & ~(uintptr_t)(page_size - 1));
+    char *end = (char*)((user + s + page_size - 1) & ~(uintptr_t)(page_size - 1));
+    if (start > ptr) {
+        unmap_pages(ptr, start - ptr);
+    }
+    if (end < ptr + total_size) {
+        unmap_pages(end, ptr + total_size - end);
+    }
 
-    // lock to protect free_list and related operations
-    pthread_mutex_lock(&malloc_lock);
+    block_t *block = (block_t*)user - 1;
+    block->prev_size = 0;
+    block->size = end - (char*)user;
+    block->free = 0;
+    block->prev_free = 0;
+    block->mapped = 1;
+    block->sampled = 0;
+    block->owner = 0;
+    if (guard != 0) {
+        block->size -= guard;
+        mprotect(end - guard, guard, PROT_NONE);
+    }
+    return block;
+}
 
-    size_t page_size = get_page_size();
+// helper: mark block free and coalesce it with free neighbours, which the
+// boundary tags locate in O(1). prints coalesce debug messages as required.
+// the resulting block is filed under its (possibly grown) size class and
+// returned
+block_t *insert_into_free_list(block_t *block) {
+    assert(block != NULL);
+    block->free = 1;
 
-    // For large blocks, use munmap
-    if (!is_small_block(block->size)) {
-        size_t num_pages = (block->size + BLOCK_SIZE + page_size - 1) / page_size;
-        size_t total_size = num_pages * page_size;
-        debug_printf("free: munmap region of size %zu\n", total_size);
-        debug_printf("Freed %zu bytes\n", block->size);
-        pthread_mutex_unlock(&malloc_lock);
-        munmap(block, total_size);
-        return;
+    // Attempt coalescing with next
+    block_t *next = next_block(block);
+    if (next->free == 1) {
+        size_t new_size = block->size + BLOCK_SIZE + next->size;
+        debug_printf("free: coalesce blocks of size %zu and %zu to new block of size %zu\n",
+                    block->size, next->size, new_size);
+        class_remove(next);
+        STAT_INC(STAT_COALESCES);
+        block->size = new_size;
     }
 
-    debug_printf("Freed %zu bytes\n", block->size);
+    // Attempt coalescing with previous
+    if (block->prev_free) {
+        block_t *prev = prev_block(block);
+        size_t new_size = prev->size + BLOCK_SIZE + block->size;
+        debug_printf("free: coalesce blocks of size %zu and %zu to new block of size %zu\n",
+                    prev->size, block->size, new_size);
+        class_remove(prev);
+        STAT_INC(STAT_COALESCES);
+        prev->size = new_size;
+        block = prev;
+    }
 
-    // For small blocks, add the block to free list and coalesce if needed
-    insert_into_free_list(block);
-
-    // Keep at most 2 page-sized free blocks in free list, unmap extras
-    size_t page_sized_blocks = 0;
-    block_t *prev = NULL;
-    block_t *current = free_list;
-    size_t page_user_size = get_page_size() - BLOCK_SIZE;
-
-    // traverse free list and count/remove excess page-sized blocks
-    while (current != NULL) {
-        if (current->size == page_user_size) {
-            page_sized_blocks++;
-            if (page_sized_blocks > 2) {
-                // unmap this block
-                if (prev == NULL) {
-                    free_list = current->next;
-                } else {
-                    prev->next = current->next;
-                }
+    set_boundary_tag(block);
+    class_insert(block);
+    return block;
+}
 
-                block_t *to_unmap = current;
-                current = current->next;
-                debug_printf("free: munmap region of size %zu\n", page_size);
-                munmap(to_unmap, page_size);
-                continue;
-            }
+// helper: search one size class of an arena first-fit for a block of at
+// least size bytes, looking at no more than CLASS_SEARCH_LIMIT blocks
+static block_t *search_class(arena_t *arena, unsigned index, size_t size) {
+    block_t *current = arena->size_classes[index];
+    for (int i = 0; current != NULL && i < CLASS_SEARCH_LIMIT; i++) {
+        if (current->size >= size) {
+            return current;
+        }
+        current = link_get(&LINKS(current)->next);
+    }
+    return NULL;
+}
+
+// helper function, find_free_block
+// purpose, locate a free block large enough to hold size bytes. the head of
+// the request's own size class is searched first-fit; failing that, any
+// block in a higher class fits, so the first non-empty one is picked from
+// the bitmap in O(1)
+block_t *find_and_remove_free_block(arena_t *arena, size_t size) {
+    unsigned index = size_class(size);
+    block_t *found = search_class(arena, index, size);
+
+    if (found == NULL) {
+        uint64_t higher = index + 1 < NUM_CLASSES
+            ? arena->class_bitmap & (~0UL << (index + 1)) : 0;
+        if (higher == 0) {
+            // no suitable free block found
+            return NULL;
         }
-        prev = current;
-        current = current->next;
+        found = arena->size_classes[__builtin_ctzl(higher)];
     }
 
-    pthread_mutex_unlock(&malloc_lock);
-}
\ No newline at end of file
+    class_remove(found);
+    found->free = 0;
+    set_boundary_tag(found);
+    debug_printf("malloc: block of size %zu found\n", found->size);
+    return found;
+}
+
+// add_more_space helper
+// request a new chunk for an arena from the os using mmap when no existing
+// free block can satisfy the request arguments
+block_t *allocate_new_chunk(arena_t *arena) {
+    size_t arena_size = get_arena_size();
+    unsigned short index = arena - arenas;
+
+    // for small blocks, allocate one chunk (a page unless in arena mode) with mmap
+    void *ptr = map_huge_pages(arena_size);
+    if (ptr == NULL) return NULL;
+    bind_to_node(ptr, arena_size, index);
+
+    chunk_t *chunk = (chunk_t*)ptr;
+    chunk->size = arena_size;
+
+    // the rest of the chunk is one block followed by the epilogue
+    block_t *block = (block_t*)(chunk + 1);
+    block->prev_size = 0;
+    block->size = chunk_payload_size();
+    block->free = 0;
+    block->prev_free = 0;
+    block->mapped = 0;
+    block->sampled = 0;
+    block->arena = index;
+    block->owner = 0;
+
+    block_t *epilogue = next_block(block);
+    epilogue->prev_size = block->size;
+    epilogue->size = 0;
+    epilogue->free = 0;
+    epilogue->prev_free = 0;
+    epilogue->mapped = 0;
+    epilogue->sampled = 0;
+    epilogue->arena = index;
+    epilogue->owner = 0;
+
+    return block;
+}
+
+// helper: unmap the chunk whose entire payload is the given free block
+static void release_chunk(block_t *block) {
+    chunk_t *chunk = (chunk_t*)block - 1;
+    class_remove(block);
+    debug_printf("free: munmap region of size %zu\n", chunk->size);
+    unmap_pages(chunk, chunk->size);
+}
+
+// helper: put the free block covering a whole chunk on its arena's empty
+// list
+static void empty_chunk_add(block_t *block) {
+    arena_t *arena = block_arena(block);
+    empty_chunk_t *empty = EMPTY(block);
+    empty->since = now_ms();
+    empty->purged = 0;
+    empty->newer = NULL;
+    empty->older = arena->empty_newest;
+    if (arena->empty_newest != NULL) {
+        EMPTY(arena->empty_newest)->newer = block;
+    } else {
+        arena->empty_oldest = block;
+    }
+    arena->empty_newest = block;
+    arena->empty_chunks++;
+}
+
+// helper: take the free block covering a whole chunk off its arena's empty
+// list
+static void empty_chunk_remove(block_t *block) {
+    arena_t *arena = block_arena(block);
+    empty_chunk_t *empty = EMPTY(block);
+    if (empty->newer != NULL) {
+        EMPTY(empty->newer)->older = empty->older;
+    } else {
+        arena->empty_newest = empty->older;
+    }
+    if (empty->older != NULL) {
+        EMPTY(empty->older)->newer = empty->newer;
+    } else {
+        arena->empty_oldest = empty->newer;
+    }
+    arena->empty_chunks--;
+}
+
+// helper: release the whole pages of an empty chunk between the free
+// block's links and the epilogue with madvise, keeping the mapping. a
+// single-page chunk has no such pages
+static void purge_chunk(block_t *block) {
+    size_t page_size = get_page_size();
+    uintptr_t start = ((uintptr_t)(EMPTY(block) + 1) + page_size - 1) & ~(uintptr_t)(page_size - 1);
+    uintptr_t end = (uintptr_t)next_block(block) & ~(uintptr_t)(page_size - 1);
+    EMPTY(block)->purged = 1;
+    if (end <= start) {
+        return;
+    }
+    debug_printf("free: madvise region of size %zu\n", end - start);
+    if (madvise((void*)start, end - start, get_purge_advice()) != 0 &&
+        PURGE_ADVICE != MADV_DONTNEED) {
+        // MADV_FREE needs linux 4.5
+        PURGE_ADVICE = MADV_DONTNEED;
+        madvise((void*)start, end - start, MADV_DONTNEED);
+    }
+    STAT_INC(STAT_MADVISES);
+}
+
+// helper: let an arena's empty chunks decay. the MAX_EMPTY_CHUNKS most
+// recently emptied ones stay as they are. older ones have their inner pages
+// purged once they are empty for the decay time, and are unmapped after
+// twice that. this runs whenever the arena is used, at most DECAY_BATCH
+// chunks at a time, so the work is spread over allocations and frees; an
+// idle program keeps its empty chunks. the caller must hold the arena's lock
+static void decay_empty_chunks(arena_t *arena) {
+    if (arena->empty_chunks <= MAX_EMPTY_CHUNKS) {
+        return;
+    }
+    uint64_t now = now_ms();
+    uint64_t decay = get_decay_ms();
+    size_t candidates = arena->empty_chunks - MAX_EMPTY_CHUNKS;
+    if (candidates > DECAY_BATCH) {
+        candidates = DECAY_BATCH;
+    }
+    block_t *block = arena->empty_oldest;
+    for (; candidates > 0; candidates--) {
+        empty_chunk_t *empty = EMPTY(block);
+        block_t *newer = empty->newer;
+        uint64_t age = now - empty->since;
+        if (age < decay) {
+            break;
+        }
+        if (age >= 2 * decay) {
+            empty_chunk_remove(block);
+            release_chunk(block);
+        } else if (!empty->purged) {
+            purge_chunk(block);
+        }
+        block = newer;
+    }
+}
+
+// helper: shrink an allocated small block to (aligned) size s if the rest is
+// large enough to be a block of its own, which is freed (and coalesced with
+// a free right neighbour). returns the split-off block, or NULL if the block
+// was left alone. the caller must hold the block's arena lock
+static block_t *split_block(block_t *block, size_t s) {
+    if (block->size <= s || block->size - s < BLOCK_SIZE + BLOCK_SIZE) {
+        return NULL;
+    }
+    size_t leftover = block->size - s;
+
+    // split: allocated part remains at start, leftover becomes a free block
+    block->size = s;
+    block->free = 0;
+
+    block_t *leftover_block = next_block(block);
+    leftover_block->prev_size = s;
+    leftover_block->size = leftover - BLOCK_SIZE;
+    leftover_block->prev_free = 0;
+    leftover_block->mapped = 0;
+    leftover_block->sampled = 0;
+    leftover_block->arena = block->arena;
+    leftover_block->owner = 0;
+
+    STAT_INC(STAT_SPLITS);
+    return insert_into_free_list(leftover_block);
+}
+
+// helper: take a small block of (aligned) size s from an arena, splitting
+// off any usable leftover. the caller must hold the arena's lock
+static block_t *heap_alloc_small(arena_t *arena, size_t s) {
+    decay_empty_chunks(arena);
+    block_t *block = find_and_remove_free_block(arena, s);
+    if (block == NULL && arena->empty_newest != NULL) {
+        // the bounded class search can miss empty chunks behind smaller
+        // blocks of the same class; use one before mapping another
+        block = arena->empty_newest;
+        class_remove(block);
+        block->free = 0;
+        set_boundary_tag(block);
+    }
+    if (block == NULL) {
+        debug_printf("malloc: block of size %zu not found - calling mmap\n", s);
+        block = allocate_new_chunk(arena);
+        if (block == NULL) {
+            return NULL;
+        }
+    } else if (block->size == chunk_payload_size()) {
+        empty_chunk_remove(block);
+    }
+
+    // if the new page is larger than requested, consider splitting
+    block_t *leftover_block = split_block(block, s);
+    if (leftover_block != NULL) {
+        debug_printf("malloc: splitting - blocks of size %zu and %zu created\n",
+                    block->size, leftover_block->size);
+    }
+    return block;
+}
+
+// helper: take a small block of (aligned) size s whose user data is aligned
+// to alignment bytes from the shared heap. a block with room for the worst
+// misalignment is taken, then the gap in front of the aligned address
+// becomes a free block of its own and the tail is split off as usual, so
+// nothing beyond the block header is lost. the caller must hold the arena's
+// lock
+static block_t *heap_alloc_aligned(arena_t *arena, size_t s, size_t alignment) {
+    block_t *block = heap_alloc_small(arena, s + alignment + BLOCK_SIZE + ALIGNMENT);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    uintptr_t data = (uintptr_t)(block + 1);
+    uintptr_t aligned = (data + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (aligned != data) {
+        // the gap has to hold a header and the free-list links
+        while (aligned - data < BLOCK_SIZE + ALIGNMENT) {
+            aligned += alignment;
+        }
+        size_t gap = aligned - data;
+
+        block_t *front = block;
+        block = (block_t*)aligned - 1;
+        block->size = front->size - gap;
+        block->free = 0;
+        block->mapped = 0;
+        block->sampled = 0;
+        block->arena = front->arena;
+        block->owner = 0;
+        front->size = gap - BLOCK_SIZE;
+        // publishes front in block's boundary tag
+        insert_into_free_list(front);
+        set_boundary_tag(block);
+        debug_printf("memalign: gap of size %zu in front of aligned block\n", gap);
+    }
+
+    block_t *leftover_block = split_block(block, s);
+    if (leftover_block != NULL) {
+        debug_printf("memalign: splitting - blocks of size %zu and %zu created\n",
+                    block->size, leftover_block->size);
+    }
+    return block;
+}
+
+// helper: return a small block to its arena, coalescing it and letting
+// surplus empty chunks decay. the caller must hold the arena's lock
+static void heap_free_small(block_t *block) {
+    // For small blocks, add the block to free list and coalesce if needed
+    block = insert_into_free_list(block);
+
+    if (block->size == chunk_payload_size()) {
+        empty_chunk_add(block);
+    }
+    decay_empty_chunks(block_arena(block));
+}
+
+// helper: return blocks of one cache class to their arenas until only keep
+// of them remain. a lock is only switched when the next block belongs to
+// another arena, so with one arena this takes a single acquisition
+static void tcache_flush(unsigned index, unsigned keep) {
+    arena_t *locked = NULL;
+    while (tcache.count[index] > keep) {
+        block_t *block = tcache.blocks[index];
+        tcache.blocks[index] = link_get(&LINKS(block)->next);
+        tcache.count[index]--;
+        if (block_arena(block) != locked) {
+            if (locked != NULL) {
+                unlock_heap(locked);
+            }
+            locked = block_arena(block);
+            lock_heap(locked);
+        }
+        heap_free_small(block);
+    }
+    if (locked != NULL) {
+        unlock_heap(locked);
+    }
+}
+
+// helper: push a cached-size block onto this thread's cache. once the
+// thread's cache has been flushed at exit, the block goes back to its arena
+static inline void tcache_push(block_t *block) {
+    if (tcache.exited) {
+        arena_t *arena = block_arena(block);
+        lock_heap(arena);
+        heap_free_small(block);
+        unlock_heap(arena);
+        return;
+    }
+    unsigned index = size_class(block->size);
+    block->free = BLOCK_CACHED;
+    link_set(&LINKS(block)->next, tcache.blocks[index]);
+    tcache.blocks[index] = block;
+    tcache.count[index]++;
+    if (tcache.count[index] > TCACHE_MAX) {
+        tcache_flush(index, TCACHE_MAX - TCACHE_BATCH);
+    }
+}
+
+// helper: hand a block to the thread owning heap slot owner (lock-free push)
+static void remote_push(unsigned owner, block_t *block) {
+    heap_slot_t *heap = &heaps[owner - 1];
+    block->free = BLOCK_CACHED;
+    block_t *head = __atomic_load_n(&heap->remote, __ATOMIC_RELAXED);
+    do {
+        link_set(&LINKS(block)->next, head);
+    } while (!__atomic_compare_exchange_n(&heap->remote, &head, block, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// helper: move every block other threads freed for us into our cache
+static void remote_drain(void) {
+    block_t *block = __atomic_exchange_n(&heaps[tcache.id - 1].remote, NULL,
+                                         __ATOMIC_ACQUIRE);
+    while (block != NULL) {
+        block_t *next = link_get(&LINKS(block)->next);
+        tcache_push(block);
+        block = next;
+    }
+}
+
+static void trace_init(void);
+static void trace_thread_exit(void);
+
+// pthread key destructor: give everything a finished thread cached back.
+// later destructors may still allocate and free; they bypass the cache
+static void tcache_thread_exit(void *unused) {
+    (void) unused;
+    trace_thread_exit();
+    tcache.exited = 1;
+    if (tcache.id != 0) {
+        remote_drain();
+    }
+    for (unsigned i = 0; i < TCACHE_CLASSES; i++) {
+        if (tcache.count[i] > 0) {
+            tcache_flush(i, 0);
+        }
+    }
+
+    // hand the counters over before the thread-local storage goes away
+    pthread_mutex_lock(&stats_lock);
+    for (unsigned i = 0; i < STAT_COUNT; i++) {
+        retired_stats[i] += tcache.stats[i];
+        tcache.stats[i] = 0;
+    }
+    if (tcache.id != 0) {
+        heaps[tcache.id - 1].stats = NULL;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    if (tcache.id != 0) {
+        // late remote frees still land in the slot and are drained by the
+        // next thread that takes it over
+        __atomic_store_n(&heaps[tcache.id - 1].in_use, 0, __ATOMIC_RELEASE);
+        tcache.id = 0;
+    }
+}
+
+static void tcache_make_key(void) {
+    pthread_key_create(&tcache_key, tcache_thread_exit);
+}
+
+// helper: make sure the calling thread's cache is flushed when it exits,
+// and claim a free heap slot so other threads can return our blocks
+static void tcache_register(void) {
+    // set first: pthread_setspecific may itself allocate
+    tcache.registered = 1;
+    pthread_once(&harden_once, harden_init);
+    pthread_once(&trace_once, trace_init);
+    pthread_once(&tcache_key_once, tcache_make_key);
+    pthread_setspecific(tcache_key, &tcache);
+    for (unsigned i = 0; i < MAX_HEAPS; i++) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&heaps[i].in_use, &unused, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            tcache.id = i + 1;
+            pthread_mutex_lock(&stats_lock);
+            heaps[i].stats = tcache.stats;
+            pthread_mutex_unlock(&stats_lock);
+            break;
+        }
+    }
+}
+
+// helper: does a small block of this (aligned) size go through the cache
+static inline int tcache_eligible(size_t size) {
+    return size <= EXACT_CLASS_LIMIT;
+}
+
+// sampling heap profiler. with MYMALLOC_PROFILE set to a byte count (K, M
+// and G suffixes work, "1" picks PROFILE_DEFAULT_RATE) every thread counts
+// down the bytes it allocates and records the call stack of the allocation
+// that crosses zero, then draws the next distance uniformly from
+// [1, 2 * rate], so on average one sample is taken per rate bytes. sampled
+// blocks are flagged and kept in a table until they are freed; a sample of
+// size s stands for max(s, rate) bytes. the live samples are written as a
+// legacy pprof heap profile ("pprof -http=: prog file.heap", which also
+// draws flame graphs) at exit, on SIGUSR2 and by mymalloc_dump_profile.
+// with profiling off the countdown starts at LONG_MAX, so the only cost is
+// one subtraction per allocation
+#define PROFILE_DEFAULT_RATE (512UL << 10)
+#define PROFILE_DEPTH 32        // frames per call stack
+#define PROFILE_SKIP 16         // room for the allocator's own frames
+#define PROFILE_SAMPLES (1 << 16)
+#define PROFILE_BUCKETS (1 << 14)
+#define PROFILE_SIGNAL SIGUSR2
+
+typedef struct profile_sample {
+    struct profile_sample *next;  // same bucket, or the next unused entry
+    block_t *block;               // sampled block, NULL while unused
+    size_t size;                  // its usable size when it was sampled
+    size_t weight;                // bytes the sample stands for
+    int depth;
+    void *stack[PROFILE_DEPTH];
+} profile_sample_t;
+
+static profile_sample_t **profile_buckets = NULL;
+static profile_sample_t *profile_samples = NULL;
+static profile_sample_t *profile_unused = NULL;
+static unsigned long profile_dumps = 0;
+static volatile sig_atomic_t profile_dump_pending = 0;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t profile_once = PTHREAD_ONCE_INIT;
+
+// store the sampling rate in bytes (SIZE_MAX until MYMALLOC_PROFILE is
+// read, 0 = profiling off)
+static size_t PROFILE_RATE = SIZE_MAX;
+
+// helper to get the sampling rate, reading MYMALLOC_PROFILE on first use
+static inline size_t get_profile_rate() {
+    if (PROFILE_RATE == SIZE_MAX) {
+        size_t rate = 0;
+        const char *env = getenv("MYMALLOC_PROFILE");
+        if (env != NULL) {
+            rate = parse_size(env);
+            if (rate == 1) rate = PROFILE_DEFAULT_RATE;
+        }
+        PROFILE_RATE = rate;
+    }
+    return PROFILE_RATE;
+}
+
+// helper: bucket of a sampled block
+static inline unsigned profile_bucket(block_t *block) {
+    return ((uintptr_t)block >> 4) * 0x9E3779B97F4A7C15UL >> (64 - 14);
+}
+
+// helper: append value in the given base to out, returning the new end.
+// async-signal-safe, unlike printf
+static char *format_number(char *out, unsigned long value, unsigned base) {
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value != 0);
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
+
+// helper: append a string to out, returning the new end
+static char *format_string(char *out, const char *text) {
+    while (*text != '\0') {
+        *out++ = *text++;
+    }
+    return out;
+}
+
+// helper: write n bytes of buffer to fd, giving up on errors
+static void write_all(int fd, const char *buffer, size_t n) {
+    while (n > 0) {
+        ssize_t written = write(fd, buffer, n);
+        if (written <= 0) {
+            return;
+        }
+        buffer += written;
+        n -= written;
+    }
+}
+
+// helper: write the live samples to fd as a legacy pprof heap profile,
+// followed by the memory map pprof needs for symbols. only uses
+// async-signal-safe calls. the caller must hold profile_lock
+static void profile_write(int fd) {
+    char buffer[4096];
+    unsigned long objects = 0, bytes = 0;
+    unsigned samples = profile_samples != NULL ? PROFILE_SAMPLES : 0;
+    for (unsigned i = 0; i < samples; i++) {
+        profile_sample_t *sample = &profile_samples[i];
+        if (sample->block != NULL) {
+            objects += sample->weight / sample->size;
+            bytes += sample->weight;
+        }
+    }
+
+    char *out = format_string(buffer, "heap profile: ");
+    for (int twice = 0; twice < 2; twice++) {
+        out = format_string(out, twice ? " [" : "");
+        out = format_number(out, objects, 10);
+        out = format_string(out, ": ");
+        out = format_number(out, bytes, 10);
+    }
+    out = format_string(out, "] @ heapprofile\n");
+    write_all(fd, buffer, out - buffer);
+
+    for (unsigned i = 0; i < samples; i++) {
+        profile_sample_t *sample = &profile_samples[i];
+        if (sample->block == NULL) {
+            continue;
+        }
+        out = buffer;
+        for (int twice = 0; twice < 2; twice++) {
+            out = format_string(out, twice ? " [" : "");
+            out = format_number(out, sample->weight / sample->size, 10);
+            out = format_string(out, ": ");
+            out = format_number(out, sample->weight, 10);
+        }
+        out = format_string(out, "] @");
+        for (int j = 0; j < sample->depth; j++) {
+            out = format_string(out, " 0x");
+            out = format_number(out, (uintptr_t)sample->stack[j], 16);
+        }
+        out = format_string(out, "\n");
+        write_all(fd, buffer, out - buffer);
+    }
+
+    out = format_string(buffer, "\nMAPPED_LIBRARIES:\n");
+    write_all(fd, buffer, out - buffer);
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps >= 0) {
+        ssize_t n;
+        while ((n = read(maps, buffer, sizeof(buffer))) > 0) {
+            write_all(fd, buffer, n);
+        }
+        close(maps);
+    }
+}
+
+// helper: write the profile to MYMALLOC_PROFILE_FILE (default "mymalloc")
+// followed by ".<pid>.<n>.heap". the caller must hold profile_lock
+static void profile_dump_numbered(void) {
+    char path[256];
+    const char *prefix = getenv("MYMALLOC_PROFILE_FILE");
+    if (prefix == NULL || strlen(prefix) > sizeof(path) - 64) {
+        prefix = "mymalloc";
+    }
+    char *out = format_string(path, prefix);
+    out = format_string(out, ".");
+    out = format_number(out, getpid(), 10);
+    out = format_string(out, ".");
+    out = format_number(out, profile_dumps++, 10);
+    out = format_string(out, ".heap");
+    *out = '\0';
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        profile_write(fd);
+        close(fd);
+    }
+    profile_dump_pending = 0;
+}
+
+// signal handler: dump right away unless the interrupted code holds the
+// table, in which case the next sample dumps it
+static void profile_signal(int signum) {
+    (void) signum;
+    int saved_errno = errno;
+    if (pthread_mutex_trylock(&profile_lock) == 0) {
+        profile_dump_numbered();
+        pthread_mutex_unlock(&profile_lock);
+    } else {
+        profile_dump_pending = 1;
+    }
+    errno = saved_errno;
+}
+
+static void profile_at_exit(void) {
+    pthread_mutex_lock(&profile_lock);
+    profile_dump_numbered();
+    pthread_mutex_unlock(&profile_lock);
+}
+
+// helper: set up the table, the exit and signal dumps, and warm up
+// backtrace, whose first call loads libgcc and allocates
+static void profile_start(void) {
+    profile_buckets = map_pages(PROFILE_BUCKETS * sizeof(profile_sample_t*));
+    profile_samples = map_pages(PROFILE_SAMPLES * sizeof(profile_sample_t));
+    if (profile_buckets == NULL || profile_samples == NULL) {
+        PROFILE_RATE = 0;
+        return;
+    }
+    for (unsigned i = PROFILE_SAMPLES; i-- > 0; ) {
+        profile_samples[i].next = profile_unused;
+        profile_unused = &profile_samples[i];
+    }
+
+    void *stack[PROFILE_DEPTH];
+    int was_in_profiler = tcache.in_profiler;
+    tcache.in_profiler = 1;
+    backtrace(stack, PROFILE_DEPTH);
+    tcache.in_profiler = was_in_profiler;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profile_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(PROFILE_SIGNAL, &action, NULL);
+    atexit(profile_at_exit);
+}
+
+// helper: distance in bytes to this thread's next sample
+static long profile_next_distance(size_t rate) {
+    // xorshift64, seeded per thread on first use
+    unsigned long x = tcache.sample_random;
+    if (x == 0) {
+        x = (uintptr_t)&tcache ^ now_ms() ^ 0x9E3779B97F4A7C15UL;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    tcache.sample_random = x;
+    return 1 + x % (2 * rate);
+}
+
+// helper: called when this thread's countdown ran out. the first call
+// looks at MYMALLOC_PROFILE and, with profiling off, parks the countdown
+static void __attribute__((noinline)) profile_sample(block_t *block) {
+    size_t rate = get_profile_rate();
+    if (rate == 0) {
+        tcache.sample_left = LONG_MAX;
+        return;
+    }
+    int first = tcache.sample_random == 0;
+    tcache.sample_left = profile_next_distance(rate);
+    if (first || tcache.in_profiler) {
+        return;
+    }
+    tcache.in_profiler = 1;
+    pthread_once(&profile_once, profile_start);
+
+    // the stack starts where the program called in, however many
+    // allocator frames (calloc calling malloc, the traced calls calling
+    // themselves, functions not inlined at -O0) lie in between
+    void *stack[PROFILE_DEPTH + PROFILE_SKIP];
+    int frames = backtrace(stack, PROFILE_DEPTH + PROFILE_SKIP);
+    int skip = 1;
+    while (skip < frames && stack[skip] != tcache.profile_caller) {
+        skip++;
+    }
+    if (skip == frames) {
+        skip = 1;
+    }
+    int depth = frames - skip;
+    if (depth > PROFILE_DEPTH) {
+        depth = PROFILE_DEPTH;
+    }
+
+    pthread_mutex_lock(&profile_lock);
+    profile_sample_t *sample = profile_unused;
+    if (sample != NULL && depth > 0) {
+        profile_unused = sample->next;
+        sample->block = block;
+        sample->size = block->size;
+        sample->weight = block->size < rate ? rate : block->size;
+        sample->depth = depth;
+        memcpy(sample->stack, stack + skip, depth * sizeof(void*));
+        unsigned bucket = profile_bucket(block);
+        sample->next = profile_buckets[bucket];
+        profile_buckets[bucket] = sample;
+        block->sampled = 1;
+    }
+    if (profile_dump_pending) {
+        profile_dump_numbered();
+    }
+    pthread_mutex_unlock(&profile_lock);
+    tcache.in_profiler = 0;
+}
+
+// helper: remember where the program called into the allocator, for the
+// sampled stacks. nested entry points keep the outermost caller
+static inline void *profile_enter(void *caller) {
+    void *outer = tcache.profile_caller;
+    if (outer == NULL) {
+        tcache.profile_caller = caller;
+    }
+    return outer;
+}
+
+static inline void profile_leave(void **outer) {
+    tcache.profile_caller = *outer;
+}
+
+// first statement of every entry point that allocates: records its caller
+// until it returns
+#define PROFILE_ENTRY() \
+    void *profile_outer __attribute__((cleanup(profile_leave))) = \
+        profile_enter(__builtin_return_address(0))
+
+// helper: count a fresh allocation towards this thread's next sample
+static inline void profile_count(block_t *block) {
+    tcache.sample_left -= block->size;
+    if (__builtin_expect(tcache.sample_left < 0, 0)) {
+        profile_sample(block);
+    }
+}
+
+// helper: drop the sample of a block that is freed, or re-key it to
+// moved_to when mremap moved the block
+static void profile_forget(block_t *block, block_t *moved_to) {
+    pthread_mutex_lock(&profile_lock);
+    profile_sample_t **link = &profile_buckets[profile_bucket(block)];
+    while (*link != NULL && (*link)->block != block) {
+        link = &(*link)->next;
+    }
+    profile_sample_t *sample = *link;
+    if (sample != NULL) {
+        *link = sample->next;
+        if (moved_to != NULL) {
+            unsigned bucket = profile_bucket(moved_to);
+            sample->block = moved_to;
+            sample->size = moved_to->size;
+            sample->next = profile_buckets[bucket];
+            profile_buckets[bucket] = sample;
+        } else {
+            sample->block = NULL;
+            sample->next = profile_unused;
+            profile_unused = sample;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+    if (moved_to == NULL) {
+        block->sampled = 0;
+    }
+}
+
+// allocation tracing. with MYMALLOC_TRACE naming a file, every malloc,
+// calloc, realloc, memalign and free the program makes is logged to it as a
+// fixed-size binary record (see trace.h) for tests/replay. each thread
+// fills its own mmap'd buffer and appends it to the file under trace_lock
+// when it is full, when the thread exits and, for the thread calling exit,
+// at exit. calls made inside a traced call (calloc calling malloc, ...) are
+// not logged again. a forked child stops tracing
+#define TRACE_BUFFER_RECORDS 2048
+
+typedef struct trace_buffer {
+    unsigned count;
+    trace_record_t records[TRACE_BUFFER_RECORDS];
+} trace_buffer_t;
+
+// store the trace file (-1 while not tracing), the time tracing started and
+// the number of threads that recorded so far
+static int TRACE_FD = -1;
+static uint64_t trace_start = 0;
+static unsigned trace_threads = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// helper: monotonic clock in nanoseconds
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// helper: append this thread's buffered records to the trace
+static void trace_flush(void) {
+    trace_buffer_t *buffer = tcache.trace;
+    if (buffer == NULL || buffer->count == 0 || TRACE_FD < 0) {
+        return;
+    }
+    pthread_mutex_lock(&trace_lock);
+    write_all(TRACE_FD, (const char*)buffer->records, buffer->count * sizeof(trace_record_t));
+    pthread_mutex_unlock(&trace_lock);
+    buffer->count = 0;
+}
+
+static void trace_at_exit(void) {
+    trace_flush();
+}
+
+// helper: write out and unmap the buffer of an exiting thread
+static void trace_thread_exit(void) {
+    if (tcache.trace != NULL) {
+        trace_flush();
+        unmap_pages(tcache.trace, sizeof(trace_buffer_t));
+        tcache.trace = NULL;
+    }
+}
+
+// helper: open the trace named by MYMALLOC_TRACE and write its header.
+// plain open/write, since stdio may allocate
+static void trace_init(void) {
+    const char *path = getenv("MYMALLOC_TRACE");
+    if (path == NULL || *path == '\0') {
+        return;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    trace_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(trace_record_t);
+    write_all(fd, (const char*)&header, sizeof(header));
+    trace_start = now_ns();
+    TRACE_FD = fd;
+    atexit(trace_at_exit);
+}
+
+// helper: log one call of this thread
+static void trace_record(int op, void *ptr, uintptr_t arg, size_t size) {
+    trace_buffer_t *buffer = tcache.trace;
+    if (buffer == NULL) {
+        buffer = map_pages(sizeof(trace_buffer_t));
+        if (buffer == NULL) {
+            return;
+        }
+        buffer->count = 0;
+        tcache.trace = buffer;
+        tcache.trace_thread = __atomic_fetch_add(&trace_threads, 1, __ATOMIC_RELAXED);
+    }
+    trace_record_t *record = &buffer->records[buffer->count++];
+    record->nsec = now_ns() - trace_start;
+    record->ptr = (uintptr_t)ptr;
+    record->arg = arg;
+    record->size = size < UINT32_MAX ? size : UINT32_MAX;
+    record->thread = tcache.trace_thread;
+    record->op = op;
+    record->reserved = 0;
+    if (buffer->count == TRACE_BUFFER_RECORDS) {
+        trace_flush();
+    }
+}
+
+// helper: pop a block of the given exact class from this thread's cache,
+// after taking back what other threads freed for us. NULL when it is empty
+// or the thread has exited
+static inline block_t *tcache_pop(unsigned index) {
+    if (tcache.exited) {
+        return NULL;
+    }
+    if (tcache.id != 0 &&
+        __atomic_load_n(&heaps[tcache.id - 1].remote, __ATOMIC_RELAXED) != NULL) {
+        remote_drain();
+    }
+    block_t *block = tcache.blocks[index];
+    if (block == NULL) {
+        return NULL;
+    }
+    tcache.blocks[index] = link_get(&LINKS(block)->next);
+    tcache.count[index]--;
+    block->free = 0;
+    block->owner = tcache.id;
+    debug_printf("malloc: block of size %zu found in thread cache\n", block->size);
+    STAT_INC(STAT_MALLOCS);
+    STAT_ADD(STAT_ALLOCATED, block->size);
+    profile_count(block);
+    return block;
+}
+
+// mymalloc_class
+// allocate from exact size class index, which malloc.h computes at compile
+// time for constant sizes. a cache hit skips the size checks, rounding and
+// class lookup of mymalloc; a miss falls back to it. in hardened mode the
+// class has no room for the canary, so mymalloc picks a larger one; when
+// tracing, mymalloc logs the call
+void *mymalloc_class(unsigned index) {
+    PROFILE_ENTRY();
+    block_t *block = HARDEN || TRACE_FD >= 0 ? NULL : tcache_pop(index);
+    if (block != NULL) {
+        return (void*)(block + 1);
+    }
+    return mymalloc((size_t)(index + 1) * ALIGNMENT);
+}
+
+// mymalloc
+// allocate a block of memory of size s bytes,
+// prints "malloc %zu bytes\n" for debugging
+void *mymalloc(size_t s) {
+    PROFILE_ENTRY();
+    debug_printf("Malloc %zu bytes\n", s);
+
+    // reject zero-byte allocations and sizes that overflow when rounded up
+    if (s == 0 || s > SIZE_MAX / 2) {
+        return NULL;
+    }
+    block_t *block = NULL;
+    if (!tcache.registered) {
+        tcache_register();
+    }
+    if (TRACE_FD >= 0 && !tcache.in_tracer) {
+        tcache.in_tracer = 1;
+        void *ptr = mymalloc(s);
+        tcache.in_tracer = 0;
+        if (ptr != NULL) {
+            trace_record(TRACE_MALLOC, ptr, 0, s);
+        }
+        return ptr;
+    }
+    s = align_size(s + harden_extra());
+
+    // For small requests, try free list first
+    if (is_small_block(s)) {
+        // cached sizes: pop from this thread's cache without locking,
+        // after taking back what other threads freed for us
+        unsigned index = size_class(s);
+        if (tcache_eligible(s)) {
+            block = tcache_pop(index);
+            if (block != NULL) {
+                return harden_seal(block);
+            }
+        }
+
+        // lock for thread-safety of free_list and allocator state
+        arena_t *arena = thread_arena();
+        lock_heap(arena);
+        block = heap_alloc_small(arena, s);
+
+        // refill the (empty) cache so the next requests of this size are lock-free
+        if (block != NULL && tcache_eligible(s) && !tcache.exited) {
+            for (unsigned i = 1; i < TCACHE_BATCH; i++) {
+                block_t *extra = heap_alloc_small(arena, s);
+                if (extra == NULL) {
+                    break;
+                }
+                extra->free = BLOCK_CACHED;
+                link_set(&LINKS(extra)->next, tcache.blocks[index]);
+                tcache.blocks[index] = extra;
+                tcache.count[index]++;
+            }
+        }
+        unlock_heap(arena);
+
+        if (block == NULL) {
+            return NULL;
+        }
+        block->owner = tcache_eligible(s) ? tcache.id : 0;
+    } else {
+        // Large allocation: use mmap for exact number of pages required
+        block = map_large_block(s, ALIGNMENT);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+    STAT_INC(STAT_MALLOCS);
+    STAT_ADD(STAT_ALLOCATED, block->size);
+    profile_count(block);
+    return harden_seal(block);
+}
+
+// mycalloc
+// allocate and zero-initialize an array of nmemb elements of size s
+// arguments, prints "calloc %zu bytes\n" for debugging
+void *mycalloc(size_t nmemb, size_t s) {
+    PROFILE_ENTRY();
+    size_t total_size = nmemb * s;
+
+    // detect potential overflow in multiplication
+    if (nmemb != 0 && total_size / nmemb != s) {
+        return NULL;
+    }
+
+    debug_printf("Calloc %zu bytes\n", total_size);
+
+    if (TRACE_FD >= 0 && !tcache.in_tracer) {
+        tcache.in_tracer = 1;
+        void *ptr = mycalloc(nmemb, s);
+        tcache.in_tracer = 0;
+        if (ptr != NULL) {
+            trace_record(TRACE_CALLOC, ptr, 0, total_size);
+        }
+        return ptr;
+    }
+
+    // allocate memory using mymalloc (which is thread-safe)
+    void *ptr = mymalloc(total_size);
+    if (ptr == NULL) return NULL;
+
+    // zero only the user region (mmap'd pages are already zeroed, but safe to memset)
+    memset(ptr, 0, total_size);
+
+    return ptr;
+}
+
+// myfree
+// mark a previously allocated block as free and available for reuse
+void myfree(void *ptr) {
+    if (ptr == NULL) {
+        return; // no-op on null pointer
+    }
+    if (TRACE_FD >= 0 && !tcache.in_tracer) {
+        // logged first: once freed, another thread may get the block back
+        trace_record(TRACE_FREE, ptr, 0, 0);
+        tcache.in_tracer = 1;
+        myfree(ptr);
+        tcache.in_tracer = 0;
+        return;
+    }
+
+    // get block metadata (stored immediately before the user data)
+    block_t *block = (block_t*)ptr - 1;
+    harden_check(block);
+    block->check = 0;
+
+    // prevent double free, block should not already be marked free
+    assert(block->free == 0);
+    if (block->sampled) {
+        profile_forget(block, NULL);
+    }
+
+    if (!tcache.registered) {
+        tcache_register();
+    }
+    STAT_INC(STAT_FREES);
+    STAT_ADD(STAT_RELEASED, block->size);
+
+    // For large blocks, keep the mapping for reuse or munmap it
+    if (block->mapped) {
+        debug_printf("Freed %zu bytes\n", block->size);
+        size_t guard = guard_size();
+        if (guard != 0) {
+            // the mapping may be reused without a guard at that spot
+            mprotect((char*)(block + 1) + block->size, guard, PROT_READ | PROT_WRITE);
+        }
+        map_cache_put(mapping_start(block), mapping_length(block));
+        return;
+    }
+
+    debug_printf("Freed %zu bytes\n", block->size);
+
+    // cached sizes: push onto this thread's cache, returning a batch to the
+    // shared heap once the cache is full. blocks of another live thread go
+    // back to their owner without locking
+    if (tcache_eligible(block->size)) {
+        unsigned owner = block->owner;
+        if (owner != 0 && owner != tcache.id &&
+            __atomic_load_n(&heaps[owner - 1].in_use, __ATOMIC_RELAXED)) {
+            remote_push(owner, block);
+        } else {
+            tcache_push(block);
+        }
+        return;
+    }
+
+    // lock to protect free_list and related operations
+    arena_t *arena = block_arena(block);
+    lock_heap(arena);
+    heap_free_small(block);
+    unlock_heap(arena);
+}
+
+// helper: count a block resized in place as allocated or released bytes
+static inline void stat_resize(size_t old_size, size_t new_size) {
+    if (new_size > old_size) {
+        STAT_ADD(STAT_ALLOCATED, new_size - old_size);
+    } else {
+        STAT_ADD(STAT_RELEASED, old_size - new_size);
+    }
+}
+
+// myrealloc
+// resize the block at ptr to s bytes, keeping its contents. small blocks
+// shrink by splitting and grow in place by absorbing a free right
+// neighbour; large blocks are resized with mremap, which moves pages rather
+// than copying them. otherwise the data is copied to a new block. prints
+// "realloc %zu bytes\n" for debugging
+void *myrealloc(void *ptr, size_t s) {
+    PROFILE_ENTRY();
+    if (TRACE_FD >= 0 && !tcache.in_tracer) {
+        if (ptr != NULL && s == 0) {
+            trace_record(TRACE_FREE, ptr, 0, 0);
+        }
+        tcache.in_tracer = 1;
+        void *result = myrealloc(ptr, s);
+        tcache.in_tracer = 0;
+        if (result != NULL) {
+            trace_record(TRACE_REALLOC, result, (uintptr_t)ptr, s);
+        }
+        return result;
+    }
+    if (ptr == NULL) {
+        return mymalloc(s);
+    }
+    if (s == 0) {
+        myfree(ptr);
+        return NULL;
+    }
+
+    debug_printf("Realloc %zu bytes\n", s);
+
+    if (s > SIZE_MAX / 2) {
+        return NULL;
+    }
+    size_t aligned = align_size(s + harden_extra());
+
+    block_t *block = (block_t*)ptr - 1;
+    harden_check(block);
+    assert(block->free == 0);
+
+    if (!tcache.registered) {
+        tcache_register();
+    }
+    size_t page_size = get_page_size();
+    size_t old_size = block->size;
+
+    // For large blocks, let the kernel move or extend the mapping
+    if (block->mapped) {
+        if (is_small_block(aligned) || guard_size() != 0) {
+            // shrinking to a small size: give back the mapping entirely.
+            // a guard page would end up inside a grown mapping, so with
+            // guard pages the data is always copied
+            void *copy = mymalloc(s);
+            if (copy == NULL) return NULL;
+            size_t usable = block->size - harden_extra();
+            memcpy(copy, ptr, usable < s ? usable : s);
+            myfree(ptr);
+            return copy;
+        }
+        char *start = mapping_start(block);
+        size_t offset = (char*)block - start;
+        size_t old_total = mapping_length(block);
+        size_t new_total = (offset + aligned + BLOCK_SIZE + page_size - 1) / page_size * page_size;
+        if (new_total == old_total) {
+            return ptr;
+        }
+        debug_printf("realloc: mremap region of size %zu to %zu\n", old_total, new_total);
+        void *moved = mremap(start, old_total, new_total, MREMAP_MAYMOVE);
+        if (moved == MAP_FAILED) {
+            return NULL;
+        }
+        STAT_INC(STAT_MREMAPS);
+        if (new_total > old_total) {
+            STAT_ADD(STAT_MAPPED, new_total - old_total);
+        } else {
+            STAT_ADD(STAT_UNMAPPED, old_total - new_total);
+        }
+        block_t *old_block = block;
+        block = (block_t*)((char*)moved + offset);
+        block->size = new_total - offset - BLOCK_SIZE;
+        if (block->sampled) {
+            profile_forget(old_block, block);
+        }
+        stat_resize(old_size, block->size);
+        return harden_seal(block);
+    }
+
+    if (is_small_block(aligned)) {
+        arena_t *arena = block_arena(block);
+        lock_heap(arena);
+
+        // growing: absorb the free block right after this one if that's enough
+        block_t *next = next_block(block);
+        if (block->size < aligned && next->free == 1 &&
+            block->size + BLOCK_SIZE + next->size >= aligned) {
+            class_remove(next);
+            debug_printf("realloc: grow in place - absorb block of size %zu\n", next->size);
+            block->size += BLOCK_SIZE + next->size;
+            set_boundary_tag(block);
+        }
+
+        if (block->size >= aligned) {
+            // fits (now): hand back whatever is left over
+            block_t *leftover_block = split_block(block, aligned);
+            if (leftover_block != NULL) {
+                debug_printf("realloc: splitting - blocks of size %zu and %zu created\n",
+                            block->size, leftover_block->size);
+            }
+            unlock_heap(arena);
+            stat_resize(old_size, block->size);
+            return harden_seal(block);
+        }
+        unlock_heap(arena);
+    }
+
+    // no room here: move the data to a new block
+    void *copy = mymalloc(s);
+    if (copy == NULL) return NULL;
+    size_t usable = block->size - harden_extra();
+    memcpy(copy, ptr, usable < s ? usable : s);
+    myfree(ptr);
+    return copy;
+}
+
+// mymalloc_usable_size
+// number of bytes that can be used in the block at ptr, which is at least
+// the size that was requested
+size_t mymalloc_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    block_t *block = (block_t*)ptr - 1;
+    harden_check(block);
+    return block->size - harden_extra();
+}
+
+// mymemalign
+// allocate s bytes whose address is a multiple of alignment, which must be
+// a power of two. prints "memalign %zu bytes\n" for debugging
+void *mymemalign(size_t alignment, size_t s) {
+    PROFILE_ENTRY();
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (TRACE_FD >= 0 && !tcache.in_tracer) {
+        tcache.in_tracer = 1;
+        void *ptr = mymemalign(alignment, s);
+        tcache.in_tracer = 0;
+        if (ptr != NULL) {
+            trace_record(TRACE_MEMALIGN, ptr, alignment, s);
+        }
+        return ptr;
+    }
+    if (alignment <= ALIGNMENT) {
+        return mymalloc(s);
+    }
+
+    debug_printf("Memalign %zu bytes\n", s);
+
+    // reject zero-byte allocations and sizes that overflow when rounded up
+    if (s == 0 || s > SIZE_MAX / 2 || alignment > SIZE_MAX / 4) {
+        return NULL;
+    }
+    if (!tcache.registered) {
+        tcache_register();
+    }
+    s = align_size(s + harden_extra());
+
+    block_t *block;
+    if (is_small_block(s + alignment + BLOCK_SIZE + ALIGNMENT)) {
+        arena_t *arena = thread_arena();
+        lock_heap(arena);
+        block = heap_alloc_aligned(arena, s, alignment);
+        unlock_heap(arena);
+    } else {
+        block = map_large_block(s, alignment);
+    }
+    if (block == NULL) {
+        return NULL;
+    }
+    STAT_INC(STAT_MALLOCS);
+    STAT_ADD(STAT_ALLOCATED, block->size);
+    profile_count(block);
+    return harden_seal(block);
+}
+
+// myposix_memalign
+// like mymemalign, but alignment must be a power of two and a multiple of
+// sizeof(void*). stores the block in *memptr and returns 0 or an error number
+int myposix_memalign(void **memptr, size_t alignment, size_t s) {
+    PROFILE_ENTRY();
+    if (alignment == 0 || alignment % sizeof(void*) != 0 ||
+        (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    if (s == 0) {
+        *memptr = NULL;
+        return 0;
+    }
+    void *ptr = mymemalign(alignment, s);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+// myaligned_alloc
+// C11 aligned_alloc: alignment must be a power of two
+void *myaligned_alloc(size_t alignment, size_t s) {
+    PROFILE_ENTRY();
+    return mymemalign(alignment, s);
+}
+
+// slab caches hand out objects of one fixed size from page-sized slabs with
+// no per-object header. a slab is one mmap'd page: the slab_t header sits at
+// the start (so the owning slab of an object is found by rounding its
+// address down to the page) and is followed by the objects. bitmap has bit i
+// set while object i is free
+#define SLAB_MAX_OBJECTS 512
+#define SLAB_BITMAP_WORDS (SLAB_MAX_OBJECTS / 64)
+
+// completely free slabs kept per cache before unmapping more
+#define MAX_EMPTY_SLABS 1
+
+typedef struct slab {
+    struct slab_cache *cache; // cache the slab belongs to
+    struct slab *next;        // next slab in the cache's partial/full list
+    struct slab *prev;        // previous slab in the cache's partial/full list
+    unsigned free_count;      // number of free objects in this slab
+    uint64_t bitmap[SLAB_BITMAP_WORDS];
+} __attribute__((aligned(16))) slab_t;
+
+typedef struct slab_cache {
+    size_t object_size;       // aligned size of one object
+    unsigned per_slab;        // objects that fit in one slab
+    unsigned empty_slabs;     // completely free slabs on the partial list
+    slab_t *partial;          // slabs with at least one free object
+    slab_t *full;             // slabs with no free object
+    pthread_mutex_t lock;
+    struct slab_cache *next_cache; // list of all caches, for the fork handlers
+    struct slab_cache *prev_cache;
+} slab_cache_t;
+
+// every live slab cache, so fork can hold their locks
+static slab_cache_t *slab_caches = NULL;
+static pthread_mutex_t slab_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// helper: unlink a slab from a cache list
+static void slab_list_remove(slab_t **head, slab_t *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+// helper: push a slab onto a cache list
+static void slab_list_push(slab_t **head, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (slab->next != NULL) {
+        slab->next->prev = slab;
+    }
+    *head = slab;
+}
+
+// helper: address of object i in a slab
+static inline void *slab_object(slab_t *slab, unsigned i) {
+    return (char*)(slab + 1) + (size_t)i * slab->cache->object_size;
+}
+
+// helper: map a new slab with every object free
+static slab_t *slab_new(slab_cache_t *cache) {
+    size_t page_size = get_page_size();
+    debug_printf("slab: mmap slab for %zu-byte objects\n", cache->object_size);
+    void *ptr = map_pages(page_size);
+    if (ptr == NULL) return NULL;
+
+    slab_t *slab = (slab_t*)ptr;
+    slab->cache = cache;
+    slab->free_count = cache->per_slab;
+    memset(slab->bitmap, 0, sizeof(slab->bitmap));
+    for (unsigned i = 0; i < cache->per_slab; i++) {
+        slab->bitmap[i / 64] |= 1UL << (i % 64);
+    }
+    return slab;
+}
+
+// myslab_create
+// create a cache for objects of object_size bytes. returns NULL if the
+// size is zero or a single object does not fit in a page-sized slab
+slab_cache_t *myslab_create(size_t object_size) {
+    PROFILE_ENTRY();
+    size_t page_size = get_page_size();
+    if (object_size == 0 || object_size > page_size - sizeof(slab_t)) {
+        return NULL;
+    }
+    object_size = align_size(object_size);
+
+    slab_cache_t *cache = mymalloc(sizeof(slab_cache_t));
+    if (cache == NULL) return NULL;
+
+    size_t per_slab = (page_size - sizeof(slab_t)) / object_size;
+    cache->object_size = object_size;
+    cache->per_slab = per_slab < SLAB_MAX_OBJECTS ? per_slab : SLAB_MAX_OBJECTS;
+    cache->empty_slabs = 0;
+    cache->partial = NULL;
+    cache->full = NULL;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    pthread_mutex_lock(&slab_caches_lock);
+    cache->prev_cache = NULL;
+    cache->next_cache = slab_caches;
+    if (slab_caches != NULL) {
+        slab_caches->prev_cache = cache;
+    }
+    slab_caches = cache;
+    pthread_mutex_unlock(&slab_caches_lock);
+    debug_printf("slab: cache for %zu-byte objects, %u per slab\n",
+                 cache->object_size, cache->per_slab);
+    return cache;
+}
+
+// myslab_alloc
+// take one object from the cache, mapping a new slab if every slab is full
+void *myslab_alloc(slab_cache_t *cache) {
+    pthread_mutex_lock(&cache->lock);
+    slab_t *slab = cache->partial;
+    if (slab == NULL) {
+        slab = slab_new(cache);
+        if (slab == NULL) {
+            pthread_mutex_unlock(&cache->lock);
+            return NULL;
+        }
+        slab_list_push(&cache->partial, slab);
+    } else if (slab->free_count == cache->per_slab) {
+        cache->empty_slabs--;
+    }
+
+    // first free slot from the bitmap
+    unsigned word = 0;
+    while (slab->bitmap[word] == 0) {
+        word++;
+    }
+    unsigned bit = __builtin_ctzl(slab->bitmap[word]);
+    slab->bitmap[word] &= ~(1UL << bit);
+
+    if (--slab->free_count == 0) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return slab_object(slab, word * 64 + bit);
+}
+
+// myslab_free
+// give an object obtained from myslab_alloc back to its cache
+void myslab_free(slab_cache_t *cache, void *ptr) {
+    if (ptr == NULL) {
+        return; // no-op on null pointer
+    }
+
+    slab_t *slab = (slab_t*)((uintptr_t)ptr & ~(uintptr_t)(get_page_size() - 1));
+    assert(slab->cache == cache);
+    unsigned i = ((char*)ptr - (char*)(slab + 1)) / cache->object_size;
+
+    pthread_mutex_lock(&cache->lock);
+    // prevent double free, the slot should not already be marked free
+    assert((slab->bitmap[i / 64] & (1UL << (i % 64))) == 0);
+    slab->bitmap[i / 64] |= 1UL << (i % 64);
+
+    if (slab->free_count++ == 0) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+
+    // Keep at most MAX_EMPTY_SLABS completely free slabs, unmap extras
+    if (slab->free_count == cache->per_slab) {
+        if (cache->empty_slabs < MAX_EMPTY_SLABS) {
+            cache->empty_slabs++;
+        } else {
+            slab_list_remove(&cache->partial, slab);
+            debug_printf("slab: munmap slab of %zu-byte objects\n", cache->object_size);
+            unmap_pages(slab, get_page_size());
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// myslab_destroy
+// unmap every slab of the cache, including objects still allocated
+void myslab_destroy(slab_cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&slab_caches_lock);
+    if (cache->prev_cache != NULL) {
+        cache->prev_cache->next_cache = cache->next_cache;
+    } else {
+        slab_caches = cache->next_cache;
+    }
+    if (cache->next_cache != NULL) {
+        cache->next_cache->prev_cache = cache->prev_cache;
+    }
+    pthread_mutex_unlock(&slab_caches_lock);
+
+    slab_t *lists[2] = { cache->partial, cache->full };
+    for (int l = 0; l < 2; l++) {
+        slab_t *slab = lists[l];
+        while (slab != NULL) {
+            slab_t *next = slab->next;
+            unmap_pages(slab, get_page_size());
+            slab = next;
+        }
+    }
+    pthread_mutex_destroy(&cache->lock);
+    myfree(cache);
+}
+
+// regions hand out memory for request-scoped work by bumping a pointer
+// through mmap'd chunks, with no per-object header and no per-object free.
+// everything is released at once by myregion_reset or myregion_destroy. a
+// chunk starts with a region_chunk_t header. requests too big for a
+// standard chunk get a chunk of their own, linked behind the current one so
+// the bump pointer keeps its place. a region is not locked; each one is
+// meant to be used by one thread at a time
+#define REGION_CHUNK_SIZE (64 * 1024)
+
+// standard chunks kept by a region across resets before unmapping more
+#define MAX_SPARE_CHUNKS 16
+
+typedef struct region_chunk {
+    struct region_chunk *next; // next chunk in the used or spare list
+    size_t size;               // bytes mapped, including this header
+} __attribute__((aligned(16))) region_chunk_t;
+
+typedef struct region {
+    char *ptr;                 // next free byte of the current chunk
+    char *end;                 // end of the current chunk
+    region_chunk_t *chunks;    // chunks in use, current one first
+    region_chunk_t *spare;     // standard chunks kept by myregion_reset
+    unsigned spare_count;
+} region_t;
+
+// helper: map a chunk of length bytes for a region
+static region_chunk_t *region_map_chunk(size_t length) {
+    debug_printf("region: mmap chunk of %zu bytes\n", length);
+    region_chunk_t *chunk = map_pages(length);
+    if (chunk == NULL) return NULL;
+    chunk->size = length;
+    return chunk;
+}
+
+// helper: slow path of myregion_alloc when the current chunk is too small
+static void *region_alloc_chunk(region_t *region, size_t size) {
+    size_t capacity = REGION_CHUNK_SIZE - sizeof(region_chunk_t);
+    if (size > capacity) {
+        // oversized: a chunk of its own behind the current one
+        size_t page_size = get_page_size();
+        size_t length = (size + sizeof(region_chunk_t) + page_size - 1) & ~(page_size - 1);
+        region_chunk_t *chunk = region_map_chunk(length);
+        if (chunk == NULL) return NULL;
+        if (region->chunks != NULL) {
+            chunk->next = region->chunks->next;
+            region->chunks->next = chunk;
+        } else {
+            chunk->next = NULL;
+            region->chunks = chunk;
+            region->ptr = region->end = (char*)chunk + length;
+        }
+        return chunk + 1;
+    }
+
+    region_chunk_t *chunk = region->spare;
+    if (chunk != NULL) {
+        region->spare = chunk->next;
+        region->spare_count--;
+    } else {
+        chunk = region_map_chunk(REGION_CHUNK_SIZE);
+        if (chunk == NULL) return NULL;
+    }
+    chunk->next = region->chunks;
+    region->chunks = chunk;
+    region->ptr = (char*)(chunk + 1) + size;
+    region->end = (char*)chunk + REGION_CHUNK_SIZE;
+    return chunk + 1;
+}
+
+// myregion_create
+// create an empty region. no memory is mapped until the first allocation
+region_t *myregion_create(void) {
+    PROFILE_ENTRY();
+    region_t *region = mymalloc(sizeof(region_t));
+    if (region == NULL) return NULL;
+    region->ptr = NULL;
+    region->end = NULL;
+    region->chunks = NULL;
+    region->spare = NULL;
+    region->spare_count = 0;
+    return region;
+}
+
+// myregion_alloc
+// allocate size bytes from the region, aligned like mymalloc. the memory is
+// only given back by myregion_reset or myregion_destroy
+void *myregion_alloc(region_t *region, size_t size) {
+    if (size == 0 || size > SIZE_MAX / 2) {
+        return NULL;
+    }
+    size = align_size(size);
+    if (size > (size_t)(region->end - region->ptr)) {
+        return region_alloc_chunk(region, size);
+    }
+    void *ptr = region->ptr;
+    region->ptr += size;
+    return ptr;
+}
+
+// myregion_reset
+// free everything allocated from the region at once. standard chunks are
+// kept (up to MAX_SPARE_CHUNKS) for the next round, oversized ones unmapped
+void myregion_reset(region_t *region) {
+    region_chunk_t *chunk = region->chunks;
+    while (chunk != NULL) {
+        region_chunk_t *next = chunk->next;
+        if (chunk->size == REGION_CHUNK_SIZE && region->spare_count < MAX_SPARE_CHUNKS) {
+            chunk->next = region->spare;
+            region->spare = chunk;
+            region->spare_count++;
+        } else {
+            debug_printf("region: munmap chunk of %zu bytes\n", chunk->size);
+            unmap_pages(chunk, chunk->size);
+        }
+        chunk = next;
+    }
+    region->chunks = NULL;
+    region->ptr = NULL;
+    region->end = NULL;
+}
+
+// myregion_destroy
+// unmap every chunk of the region and free the region itself
+void myregion_destroy(region_t *region) {
+    if (region == NULL) {
+        return;
+    }
+    myregion_reset(region);
+    region_chunk_t *chunk = region->spare;
+    while (chunk != NULL) {
+        region_chunk_t *next = chunk->next;
+        unmap_pages(chunk, chunk->size);
+        chunk = next;
+    }
+    myfree(region);
+}
+
+// mymalloc_get_stats
+// fill in a snapshot of the allocator statistics. the per-thread counters of
+// all live threads are added up here, and the free lists of every arena are
+// walked under its lock, so this is meant for occasional reads. blocks sitting
+// in per-thread caches count as neither in use nor free
+void mymalloc_get_stats(mymalloc_stats_t *stats) {
+    unsigned long totals[STAT_COUNT];
+
+    pthread_mutex_lock(&stats_lock);
+    memcpy(totals, retired_stats, sizeof(totals));
+    for (unsigned i = 0; i < MAX_HEAPS; i++) {
+        if (heaps[i].stats != NULL) {
+            for (unsigned j = 0; j < STAT_COUNT; j++) {
+                totals[j] += __atomic_load_n(&heaps[i].stats[j], __ATOMIC_RELAXED);
+            }
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    // a thread without a heap slot is only visible to itself
+    if (tcache.id == 0) {
+        for (unsigned j = 0; j < STAT_COUNT; j++) {
+            totals[j] += tcache.stats[j];
+        }
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    stats->in_use = totals[STAT_ALLOCATED] - totals[STAT_RELEASED];
+    stats->mapped = totals[STAT_MAPPED] - totals[STAT_UNMAPPED];
+    stats->mallocs = totals[STAT_MALLOCS];
+    stats->frees = totals[STAT_FREES];
+    stats->splits = totals[STAT_SPLITS];
+    stats->coalesces = totals[STAT_COALESCES];
+    stats->mmaps = totals[STAT_MMAPS];
+    stats->munmaps = totals[STAT_MUNMAPS];
+    stats->mremaps = totals[STAT_MREMAPS];
+    stats->lock_acquisitions = totals[STAT_LOCKS];
+    stats->lock_contentions = totals[STAT_CONTENDED];
+    stats->map_cache_hits = totals[STAT_MAP_CACHE_HITS];
+    stats->madvises = totals[STAT_MADVISES];
+
+    pthread_mutex_lock(&map_cache_lock);
+    stats->map_cache_bytes = map_cache_bytes;
+    pthread_mutex_unlock(&map_cache_lock);
+
+    for (unsigned a = 0; a < MAX_ARENAS; a++) {
+        arena_t *arena = &arenas[a];
+        pthread_mutex_lock(&arena->lock);
+        stats->empty_chunks += arena->empty_chunks;
+        for (unsigned i = 0; i < NUM_CLASSES; i++) {
+            for (block_t *block = arena->size_classes[i]; block != NULL; block = link_get(&LINKS(block)->next)) {
+                stats->free_blocks[i]++;
+                stats->free_bytes += block->size;
+                if (block->size > stats->largest_free) {
+                    stats->largest_free = block->size;
+                }
+            }
+        }
+        pthread_mutex_unlock(&arena->lock);
+    }
+
+    if (stats->free_bytes > 0) {
+        stats->fragmentation = 1.0 - (double)stats->largest_free / stats->free_bytes;
+    }
+}
+
+// mymalloc_print_stats
+// print the statistics to stderr in the style of the sbrk_stats report
+void mymalloc_print_stats(void) {
+    mymalloc_stats_t stats;
+    mymalloc_get_stats(&stats);
+
+    fprintf(stderr,
+        "==== mymalloc stats ====================\n"
+        "Bytes in use: %zu\n"
+        "Bytes mapped: %zu\n"
+        "Free bytes in shared heap: %zu\n"
+        "Largest free block: %zu\n"
+        "Fragmentation: %.3f\n"
+        "malloc/free calls: %lu/%lu\n"
+        "Splits/coalesces: %lu/%lu\n"
+        "mmap/munmap/mremap calls: %lu/%lu/%lu\n"
+        "Lock acquisitions (contended): %lu (%lu)\n"
+        "Map cache hits (cached bytes): %lu (%zu)\n"
+        "madvise calls (empty chunks): %lu (%zu)\n",
+        stats.in_use, stats.mapped, stats.free_bytes, stats.largest_free,
+        stats.fragmentation, stats.mallocs, stats.frees, stats.splits,
+        stats.coalesces, stats.mmaps, stats.munmaps, stats.mremaps,
+        stats.lock_acquisitions, stats.lock_contentions,
+        stats.map_cache_hits, stats.map_cache_bytes,
+        stats.madvises, stats.empty_chunks);
+    for (unsigned i = 0; i < NUM_CLASSES; i++) {
+        if (stats.free_blocks[i] > 0) {
+            size_t limit = i < EXACT_CLASS_LIMIT / ALIGNMENT
+                ? (i + 1) * ALIGNMENT : (size_t)1 << (i - EXACT_CLASS_LIMIT / ALIGNMENT + 10);
+            fprintf(stderr, "Free blocks up to %zu bytes: %zu\n",
+                    limit, stats.free_blocks[i]);
+        }
+    }
+    fprintf(stderr, "========================================\n");
+}
+
+// fork handlers: hold the allocator locks across fork so the child never
+// inherits one that another thread held at the time, and start the child
+// with fresh, unlocked ones. slab caches are locked after the list of
+// caches, so none is created or destroyed in between
+static void fork_prepare(void) {
+    pthread_mutex_lock(&slab_caches_lock);
+    for (slab_cache_t *cache = slab_caches; cache != NULL; cache = cache->next_cache) {
+        pthread_mutex_lock(&cache->lock);
+    }
+    pthread_mutex_lock(&stats_lock);
+    for (unsigned i = 0; i < MAX_ARENAS; i++) {
+        pthread_mutex_lock(&arenas[i].lock);
+    }
+    pthread_mutex_lock(&map_cache_lock);
+    pthread_mutex_lock(&profile_lock);
+}
+
+static void fork_parent(void) {
+    pthread_mutex_unlock(&profile_lock);
+    pthread_mutex_unlock(&map_cache_lock);
+    for (unsigned i = MAX_ARENAS; i-- > 0; ) {
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+    pthread_mutex_unlock(&stats_lock);
+    for (slab_cache_t *cache = slab_caches; cache != NULL; cache = cache->next_cache) {
+        pthread_mutex_unlock(&cache->lock);
+    }
+    pthread_mutex_unlock(&slab_caches_lock);
+}
+
+// helper: in a forked child, return what a thread that did not survive the
+// fork had cached or was sent by other threads to the arenas, fold its
+// counters into the retired ones and free its heap slot. the thread's
+// thread-local storage is still mapped in the child and found through the
+// slot's stats pointer. a block the thread was moving at the moment of the
+// fork may be missing from its lists and is lost. the child has a single
+// thread, so the arenas are used without their locks
+static void fork_release_slot(heap_slot_t *heap) {
+    if (heap->stats != NULL) {
+        tcache_t *dead = (tcache_t*)((char*)heap->stats - offsetof(tcache_t, stats));
+        for (unsigned i = 0; i < TCACHE_CLASSES; i++) {
+            block_t *block = dead->blocks[i];
+            for (unsigned n = 0; block != NULL && n < dead->count[i]; n++) {
+                if (block->free != BLOCK_CACHED || size_class(block->size) != i) {
+                    break;
+                }
+                block_t *next = link_get(&LINKS(block)->next);
+                heap_free_small(block);
+                block = next;
+            }
+            dead->blocks[i] = NULL;
+            dead->count[i] = 0;
+        }
+        for (unsigned i = 0; i < STAT_COUNT; i++) {
+            retired_stats[i] += dead->stats[i];
+        }
+        heap->stats = NULL;
+    }
+    block_t *block = heap->remote;
+    while (block != NULL) {
+        block_t *next = link_get(&LINKS(block)->next);
+        heap_free_small(block);
+        block = next;
+    }
+    heap->remote = NULL;
+    heap->in_use = 0;
+}
+
+static void fork_child(void) {
+    for (unsigned i = 0; i < MAX_ARENAS; i++) {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+    }
+    pthread_mutex_init(&stats_lock, NULL);
+    pthread_mutex_init(&map_cache_lock, NULL);
+    pthread_mutex_init(&profile_lock, NULL);
+    for (slab_cache_t *cache = slab_caches; cache != NULL; cache = cache->next_cache) {
+        pthread_mutex_init(&cache->lock, NULL);
+    }
+    pthread_mutex_init(&slab_caches_lock, NULL);
+    pthread_mutex_init(&trace_lock, NULL);
+
+    // the child's calls would mix with the parent's in the trace
+    TRACE_FD = -1;
+    if (tcache.trace != NULL) {
+        tcache.trace->count = 0;
+    }
+
+    // only the forking thread exists in the child
+    for (unsigned i = 0; i < MAX_HEAPS; i++) {
+        if (heaps[i].in_use && i + 1 != tcache.id) {
+            fork_release_slot(&heaps[i]);
+        }
+    }
+}
+
+static void install_fork_handlers(void) __attribute__ ((constructor));
+
+static void install_fork_handlers(void) {
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+// print the statistics at exit when MYMALLOC_STATS is set
+static void stats_at_exit(void) __attribute__ ((constructor));
+
+static void stats_at_exit(void) {
+    const char *env = getenv("MYMALLOC_STATS");
+    if (env != NULL && *env != '\0' && *env != '0') {
+        atexit(mymalloc_print_stats);
+    }
+}
+
+// mymalloc_dump_profile
+// write the live samples of the heap profiler to path as a legacy pprof
+// heap profile. returns 0, or -1 if the file can't be written
+int mymalloc_dump_profile(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&profile_lock);
+    profile_write(fd);
+    pthread_mutex_unlock(&profile_lock);
+    close(fd);
+    return 0;
+}
+
+// start the heap profiler when MYMALLOC_PROFILE is set, so the exit dump is
+// registered even by a program that never allocates enough for a sample
+static void profile_at_start(void) __attribute__ ((constructor));
+
+static void profile_at_start(void) {
+    if (get_profile_rate() != 0) {
+        pthread_once(&profile_once, profile_start);
+    }
+}
@@ -0,0 +1,104 @@
+/**
+ * Standard allocator entry points on top of mymalloc, so the allocator can
+ * be built as a shared library and preloaded into any dynamically linked
+ * program instead of glibc malloc:
+ *
+ * make libmymalloc.so
+ * LD_PRELOAD=$PWD/libmymalloc.so ./program
+ *
+ * This file must not include malloc.h, whose macros rename exactly the
+ * functions defined here.
+ */
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+
+void *mymalloc(size_t size);
+void *mycalloc(size_t nmemb, size_t size);
+void *myrealloc(void *ptr, size_t size);
+void myfree(void *ptr);
+void *mymemalign(size_t alignment, size_t size);
+int myposix_memalign(void **memptr, size_t alignment, size_t size);
+size_t mymalloc_usable_size(void *ptr);
+
+// programs expect malloc(0) to return a unique pointer, mymalloc returns NULL
+void *malloc(size_t size) {
+  void *ptr = mymalloc(size == 0 ? 1 : size);
+  if (ptr == NULL) {
+    errno = ENOMEM;
+  }
+  return ptr;
+}
+
+void free(void *ptr) {
+  myfree(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  if (nmemb == 0 || size == 0) {
+    nmemb = size = 1;
+  }
+  void *ptr = mycalloc(nmemb, size);
+  if (ptr == NULL) {
+    errno = ENOMEM;
+  }
+  return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+  if (ptr == NULL && size == 0) {
+    size = 1;
+  }
+  void *result = myrealloc(ptr, size);
+  if (result == NULL && size != 0) {
+    errno = ENOMEM;
+  }
+  return result;
+}
+
+// glibc's reallocarray does not go through realloc, so it has to be replaced
+void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+  size_t total;
+  if (__builtin_mul_overflow(nmemb, size, &total)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return realloc(ptr, total);
+}
+
+// mymemalign sets errno only for a bad alignment, so a stale EINVAL must
+// not be mistaken for one
+void *memalign(size_t alignment, size_t size) {
+  int saved_errno = errno;
+  errno = 0;
+  void *ptr = mymemalign(alignment, size == 0 ? 1 : size);
+  if (ptr == NULL) {
+    if (errno != EINVAL) {
+      errno = ENOMEM;
+    }
+  } else {
+    errno = saved_errno;
+  }
+  return ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+  return myposix_memalign(memptr, alignment, size == 0 ? 1 : size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+void *valloc(size_t size) {
+  return memalign(sysconf(_SC_PAGE_SIZE), size);
+}
+
+void *pvalloc(size_t size) {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  return memalign(page_size, (size + page_size - 1) / page_size * page_size);
+}
+
+size_t malloc_usable_size(void *ptr) {
+  return mymalloc_usable_size(ptr);
+}
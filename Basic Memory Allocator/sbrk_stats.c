@@ -2,14 +2,24 @@
  * Wrapper for sbrk to collect usage statistics. And printing at the end of
  * a program. Note: calling exit explicitly might skip the stats printing.
  *
+ * mmap, mremap and munmap are wrapped the same way, so the number of
+ * mappings the allocator creates (e.g. with and without MYMALLOC_ARENA_SIZE)
+ * can be compared.
+ *
  * If compiling without the provided Makefile, use the following gcc options:
  *
- * gcc -g --Wl,--wrap=sbrk std=gnu11 -I. mymalloc.c sbrk_stats.c prog.c -o prog
+ * gcc -g -Wl,--wrap=sbrk,--wrap=mmap,--wrap=mremap,--wrap=munmap -std=gnu11 -I. mymalloc.c sbrk_stats.c prog.c -o prog
  */
 #include <unistd.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 extern void *__real_sbrk(intptr_t increment);
+extern void *__real_mmap(void *addr, size_t length, int prot, int flags,
+                         int fd, off_t offset);
+extern void *__real_mremap(void *old_address, size_t old_size,
+                           size_t new_size, int flags, ...);
+extern int __real_munmap(void *addr, size_t length);
 
 static struct {
   unsigned long added;
@@ -17,6 +27,14 @@ static struct {
   unsigned long count;
 } sbrk_stats = { 0 };
 
+static struct {
+  unsigned long count;
+  unsigned long mapped;
+  unsigned long remap_count;
+  unsigned long unmap_count;
+  unsigned long unmapped;
+} mmap_stats = { 0 };
+
 /** sbrk wrapper */
 void *__wrap_sbrk(intptr_t increment) {
   sbrk_stats.count++;
@@ -30,21 +48,54 @@ void *__wrap_sbrk(intptr_t increment) {
   return __real_sbrk(increment);
 }
 
+/** mmap wrapper (the allocator may call it from several threads) */
+void *__wrap_mmap(void *addr, size_t length, int prot, int flags,
+                  int fd, off_t offset) {
+  __atomic_fetch_add(&mmap_stats.count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&mmap_stats.mapped, length, __ATOMIC_RELAXED);
+
+  return __real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+/** mremap wrapper (the allocator never passes a new address) */
+void *__wrap_mremap(void *old_address, size_t old_size, size_t new_size,
+                    int flags, ...) {
+  __atomic_fetch_add(&mmap_stats.remap_count, 1, __ATOMIC_RELAXED);
+
+  return __real_mremap(old_address, old_size, new_size, flags);
+}
+
+/** munmap wrapper */
+int __wrap_munmap(void *addr, size_t length) {
+  __atomic_fetch_add(&mmap_stats.unmap_count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&mmap_stats.unmapped, length, __ATOMIC_RELAXED);
+
+  return __real_munmap(addr, length);
+}
+
 // Make stats print automatically after main finishes
 void print_stats (void) __attribute__ ((destructor));
 
-/** Print some statistics about the use of sbrk */
+/** Print some statistics about the use of sbrk, mmap and munmap */
 void print_stats() {
   fprintf(stderr, 
       "==== sbrk stats ========================\n"
       "Total call count: %lu\n"
       "Total memory added: %lu\n"
       //"Total memory returned: %lu\n"
+      "==== mmap stats ========================\n"
+      "mmap call count: %lu\n"
+      "Total memory mapped: %lu\n"
+      "mremap call count: %lu\n"
+      "munmap call count: %lu\n"
+      "Total memory unmapped: %lu\n"
       "========================================\n",
       sbrk_stats.count,
-      sbrk_stats.added); /*,
-      //sbrk_stats.returned);*/
+      sbrk_stats.added, /*
+      //sbrk_stats.returned,*/
+      mmap_stats.count,
+      mmap_stats.mapped,
+      mmap_stats.remap_count,
+      mmap_stats.unmap_count,
+      mmap_stats.unmapped);
 }
-
-
-
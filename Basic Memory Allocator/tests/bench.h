@@ -0,0 +1,20 @@
+// Small helpers shared by the benchmark programs in this directory
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <time.h>
+
+/** Current monotonic time in seconds. */
+static inline double now_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** Print one benchmark result line as "<name>: <ops> ops in <secs> s (<rate> ops/sec)". */
+#define report(name, ops, secs) \
+  fprintf(stderr, "%-36s %10lu ops in %8.3f s  (%12.0f ops/sec)\n", \
+          name, (unsigned long) (ops), secs, (ops) / (secs))
+
+#endif /* ifndef _BENCH_H */
@@ -0,0 +1,102 @@
+// Allocation throughput benchmark
+// replays the random-size workloads of test6 (free in allocation order) and
+// test7 (interleaved frees) on top of a fragmented heap, so the cost of
+// finding a free block is visible. Only the first word of each block is
+// touched to keep the numbers about the allocator rather than memset.
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define FRAGMENTS 20000
+
+static void *keep[FRAGMENTS];
+
+static void *touch(void *ptr) {
+  if (ptr != NULL) {
+    *(int *) ptr = 1;
+  }
+  return ptr;
+}
+
+// leave FRAGMENTS free holes of assorted small sizes between live blocks
+static void fragment_heap(void) {
+  void *holes[FRAGMENTS];
+  for (int i = 0; i < FRAGMENTS; i++) {
+    holes[i] = malloc(16 + rand() % 512);
+    keep[i] = malloc(16 + rand() % 512);
+  }
+  for (int i = 0; i < FRAGMENTS; i++) {
+    free(holes[i]);
+  }
+}
+
+// test6: malloc 8 blocks, free them in allocation order
+static unsigned long run_test6(int iterations, int max_shift) {
+  void *data[8];
+  for (int i = 0; i < iterations; i++) {
+    for (int j = 0; j < 8; j++) {
+      data[j] = touch(malloc(8 << (rand() % max_shift)));
+    }
+    for (int j = 0; j < 8; j++) {
+      free(data[j]);
+    }
+  }
+  return 8UL * iterations;
+}
+
+// test7: mallocs and frees interleaved
+static unsigned long run_test7(int iterations, int max_shift) {
+  for (int i = 0; i < iterations; i++) {
+    void *data = touch(malloc(8 << (rand() % max_shift)));
+    void *data1 = touch(malloc(8 << (rand() % max_shift)));
+    free(data);
+    free(data1);
+    void *data2 = touch(malloc(8 << (rand() % max_shift)));
+    void *data3 = touch(malloc(8 << (rand() % max_shift)));
+    free(data2);
+    free(data3);
+    void *data4 = touch(malloc(8 << (rand() % max_shift)));
+    free(data4);
+    void *data5 = touch(malloc(8 << (rand() % max_shift)));
+    void *data6 = touch(malloc(8 << (rand() % max_shift)));
+    free(data5);
+    free(data6);
+  }
+  return 7UL * iterations;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+
+  srand(3650);
+  fragment_heap();
+
+  double start = now_secs();
+  unsigned long ops = run_test6(iterations, 9);
+  report("test6 small (8..2048 B)", ops, now_secs() - start);
+
+  start = now_secs();
+  ops = run_test7(iterations, 9);
+  report("test7 small (8..2048 B)", ops, now_secs() - start);
+
+  start = now_secs();
+  ops = run_test6(iterations, 20);
+  report("test6 all sizes (8 B..4 MiB)", ops, now_secs() - start);
+
+  start = now_secs();
+  ops = run_test7(iterations, 20);
+  report("test7 all sizes (8 B..4 MiB)", ops, now_secs() - start);
+
+  for (int i = 0; i < FRAGMENTS; i++) {
+    free(keep[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+// Constant-size malloc benchmark
+// times tight malloc/free loops of a fixed-size struct, once with the size
+// written as sizeof (a compile-time constant, so malloc.h picks the size
+// class at compile time) and once with the same size read from a volatile
+// (the generic mymalloc path). Both loops are served by the thread cache.
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define BATCH 16
+
+typedef struct {
+  long key;
+  long value;
+  void *left;
+  void *right;
+  void *parent;
+  int color;
+} node_t;
+
+static volatile size_t node_size = sizeof(node_t);
+
+// malloc BATCH nodes, then free them, with the size known to the compiler
+static unsigned long run_constant(int iterations) {
+  node_t *nodes[BATCH];
+  for (int i = 0; i < iterations; i++) {
+    for (int j = 0; j < BATCH; j++) {
+      nodes[j] = malloc(sizeof(node_t));
+      nodes[j]->key = j;
+    }
+    for (int j = 0; j < BATCH; j++) {
+      free(nodes[j]);
+    }
+  }
+  return 2UL * BATCH * iterations;
+}
+
+// the same loop with a size only known at run time
+static unsigned long run_generic(int iterations) {
+  node_t *nodes[BATCH];
+  for (int i = 0; i < iterations; i++) {
+    for (int j = 0; j < BATCH; j++) {
+      nodes[j] = malloc(node_size);
+      nodes[j]->key = j;
+    }
+    for (int j = 0; j < BATCH; j++) {
+      free(nodes[j]);
+    }
+  }
+  return 2UL * BATCH * iterations;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 2000000;
+
+  // warm up the thread cache so neither loop pays for the first refill
+  run_generic(1000);
+
+  for (int round = 0; round < 2; round++) {
+    double start = now_secs();
+    unsigned long ops = run_generic(iterations);
+    report("generic path (runtime size)", ops, now_secs() - start);
+
+    start = now_secs();
+    ops = run_constant(iterations);
+    report("size class at compile time", ops, now_secs() - start);
+  }
+  return 0;
+}
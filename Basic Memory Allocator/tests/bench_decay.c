@@ -0,0 +1,121 @@
+// Bursty workload benchmark
+// alternates bursts that allocate and free about 16 MiB of small blocks
+// with quiet phases of light malloc/free traffic, and reports the rss
+// right after every burst and at the end of the quiet phase that follows,
+// plus the mmap, munmap and madvise calls.
+// Every configuration runs in a child process started with the
+// MYMALLOC_DECAY_MS and MYMALLOC_ARENA_SIZE values below, so immediate
+// release (decay 0, the old behaviour) can be compared with decayed release
+// in page and arena mode.
+
+#include <malloc.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define CYCLES 10
+#define BURST_BLOCKS 16000
+#define QUIET_MS 300
+#define QUIET_BLOCKS 64
+
+static void *blocks[BURST_BLOCKS];
+
+static const char *configs[][2] = {
+  // MYMALLOC_DECAY_MS, MYMALLOC_ARENA_SIZE
+  {"0", "4K"},
+  {"200", "4K"},
+  {"1000", "4K"},
+  {"0", "1M"},
+  {"200", "1M"},
+  {"1000", "1M"},
+};
+
+static unsigned long next_random(unsigned long *state) {
+  *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+  return *state >> 33;
+}
+
+static size_t rss_mib(void) {
+  unsigned long pages = 0, resident = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm != NULL) {
+    if (fscanf(statm, "%lu %lu", &pages, &resident) != 2) resident = 0;
+    fclose(statm);
+  }
+  return resident * sysconf(_SC_PAGE_SIZE) >> 20;
+}
+
+static void run(void) {
+  unsigned long state = 7;
+  size_t burst_rss[CYCLES], quiet_rss[CYCLES];
+
+  double start = now_secs();
+  for (int cycle = 0; cycle < CYCLES; cycle++) {
+    for (int i = 0; i < BURST_BLOCKS; i++) {
+      size_t size = 528 + next_random(&state) % 1520;
+      blocks[i] = malloc(size);
+      memset(blocks[i], 1, size);
+    }
+    // free in random order so chunks empty out late
+    for (int i = BURST_BLOCKS - 1; i > 0; i--) {
+      int j = next_random(&state) % (i + 1);
+      void *swap = blocks[i];
+      blocks[i] = blocks[j];
+      blocks[j] = swap;
+    }
+    for (int i = 0; i < BURST_BLOCKS; i++) {
+      free(blocks[i]);
+    }
+    burst_rss[cycle] = rss_mib();
+
+    double quiet_end = now_secs() + QUIET_MS / 1000.0;
+    while (now_secs() < quiet_end) {
+      for (int i = 0; i < QUIET_BLOCKS; i++) {
+        blocks[i] = malloc(64);
+      }
+      for (int i = 0; i < QUIET_BLOCKS; i++) {
+        free(blocks[i]);
+      }
+      usleep(1000);
+    }
+    quiet_rss[cycle] = rss_mib();
+  }
+  double secs = now_secs() - start;
+
+  mymalloc_stats_t stats;
+  mymalloc_get_stats(&stats);
+  fprintf(stderr, "decay %4s ms, chunks %2s: %.2f s, mmap/munmap/madvise %lu/%lu/%lu, rss after burst>quiet (MiB):",
+          getenv("MYMALLOC_DECAY_MS"), getenv("MYMALLOC_ARENA_SIZE"), secs,
+          stats.mmaps, stats.munmaps, stats.madvises);
+  for (int cycle = 0; cycle < CYCLES; cycle++) {
+    fprintf(stderr, " %zu>%zu", burst_rss[cycle], quiet_rss[cycle]);
+  }
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    run();
+    return 0;
+  }
+  for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      setenv("MYMALLOC_DECAY_MS", configs[i][0], 1);
+      setenv("MYMALLOC_ARENA_SIZE", configs[i][1], 1);
+      execl(argv[0], argv[0], "run", (char *) NULL);
+      perror("execl");
+      _exit(1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+  return 0;
+}
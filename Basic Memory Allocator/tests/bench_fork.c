@@ -0,0 +1,108 @@
+// Fork latency benchmark
+// times fork() in the parent with the allocator idle and while threads
+// allocate and free, and how much of it is spent in the allocator's fork
+// handlers taking and dropping its locks. The benchmark registers fork
+// handlers of its own before and after the allocator's, which run right
+// around the allocator's handlers: prepare handlers run in reverse order of
+// registration, parent handlers in order.
+
+#include <malloc.h>
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define FORKS 2000
+#define WORKERS 4
+
+static double prepare_start, prepare_end, parent_start, parent_end;
+static volatile int stop = 0;
+
+static void before_prepare(void) { prepare_start = now_secs(); }
+static void after_prepare(void) { prepare_end = now_secs(); }
+static void before_parent(void) { parent_start = now_secs(); }
+static void after_parent(void) { parent_end = now_secs(); }
+
+// runs before the allocator's constructor registers its handlers
+static void register_inner(void) __attribute__((constructor(101)));
+
+static void register_inner(void) {
+  pthread_atfork(after_prepare, before_parent, NULL);
+}
+
+static void *worker(void *arg) {
+  unsigned seed = (unsigned) (long) arg;
+  void *window[64] = { NULL };
+  while (!stop) {
+    int slot = rand_r(&seed) % 64;
+    free(window[slot]);
+    window[slot] = malloc(16 + rand_r(&seed) % 4000);
+  }
+  for (int i = 0; i < 64; i++) {
+    free(window[i]);
+  }
+  return NULL;
+}
+
+static int compare(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static void run(const char *name) {
+  static double total[FORKS], handlers[FORKS];
+  for (int i = 0; i < FORKS; i++) {
+    double start = now_secs();
+    pid_t pid = fork();
+    if (pid == 0) {
+      _exit(0);
+    }
+    double end = now_secs();
+    assert(pid > 0);
+    waitpid(pid, NULL, 0);
+    total[i] = (end - start) * 1e6;
+    handlers[i] = ((prepare_end - prepare_start) + (parent_end - parent_start)) * 1e6;
+  }
+  qsort(total, FORKS, sizeof(double), compare);
+  qsort(handlers, FORKS, sizeof(double), compare);
+  double sum_total = 0, sum_handlers = 0;
+  for (int i = 0; i < FORKS; i++) {
+    sum_total += total[i];
+    sum_handlers += handlers[i];
+  }
+  fprintf(stderr, "%-28s fork %7.1f us mean %7.1f us p99, allocator handlers %6.2f us mean %7.2f us p99\n",
+          name, sum_total / FORKS, total[FORKS * 99 / 100],
+          sum_handlers / FORKS, handlers[FORKS * 99 / 100]);
+}
+
+int main(void) {
+  pthread_atfork(before_prepare, after_parent, NULL);
+
+  // some heap so the page tables have something to copy
+  void *heap[1000];
+  for (int i = 0; i < 1000; i++) {
+    heap[i] = malloc(16 + i * 8);
+  }
+
+  run("idle allocator");
+
+  pthread_t workers[WORKERS];
+  for (long i = 0; i < WORKERS; i++) {
+    assert(pthread_create(&workers[i], NULL, worker, (void *) i) == 0);
+  }
+  run("4 threads allocating");
+  stop = 1;
+  for (int i = 0; i < WORKERS; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  for (int i = 0; i < 1000; i++) {
+    free(heap[i]);
+  }
+  return 0;
+}
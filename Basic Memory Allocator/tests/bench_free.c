@@ -0,0 +1,67 @@
+// Free latency benchmark
+// builds a free list of N non-adjacent holes (allocate 2N blocks, free every
+// other one) and then measures how long freeing live blocks takes, for N
+// from 10 to 10^5. Every measured free lands between two free holes and
+// coalesces with both, but every other live block stays allocated so no
+// chunk becomes empty and the numbers are not about munmap. Blocks are
+// 600 bytes so they bypass the per-thread caches and really go back to the
+// shared heap. The measured blocks are freed in random order so an allocator
+// that has to search an address-ordered list cannot get lucky.
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define MAX_HOLES 100000
+#define BLOCK_BYTES 600
+#define MEASURED 1000
+
+static void *blocks[2 * MAX_HOLES];
+static int order[MEASURED];
+
+int main() {
+  srand(3650);
+  for (int holes = 10; holes <= MAX_HOLES; holes *= 10) {
+    for (int i = 0; i < 2 * holes; i++) {
+      blocks[i] = malloc(BLOCK_BYTES);
+    }
+    for (int i = 0; i < 2 * holes; i += 2) {
+      free(blocks[i]);
+    }
+
+    // free up to MEASURED of the live blocks 1, 5, 9, ... spread over the heap
+    int measured = holes / 2 < MEASURED ? holes / 2 : MEASURED;
+    int stride = 4 * (holes / 2 / measured);
+    for (int i = 0; i < measured; i++) {
+      order[i] = i * stride + 1;
+    }
+    for (int i = measured - 1; i > 0; i--) {
+      int j = rand() % (i + 1);
+      int tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+
+    double start = now_secs();
+    for (int i = 0; i < measured; i++) {
+      free(blocks[order[i]]);
+      blocks[order[i]] = NULL;
+    }
+    double elapsed = now_secs() - start;
+
+    fprintf(stderr, "%6d free blocks: %10.1f ns per free\n",
+            holes, elapsed * 1e9 / measured);
+
+    for (int i = 1; i < 2 * holes; i += 2) {
+      free(blocks[i]);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,98 @@
+// Hardened mode overhead benchmark
+// times a malloc/free loop over random sizes from 16 bytes to 4 KiB with
+// 1000 live blocks, writing every block, in child processes started with
+// MYMALLOC_HARDEN unset, set to 1 and set to guard, and reports the
+// slowdown of each mode. Every run keeps the best of three passes.
+
+#include <malloc.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define OPS 5000000UL
+#define RUNS 3
+#define LIVE 1000
+
+static void *live[LIVE];
+
+static double run_once(void) {
+  unsigned long state = 1;
+  double start = now_secs();
+  for (unsigned long i = 0; i < OPS; i++) {
+    state = state * 6364136223846793005UL + 1442695040888963407UL;
+    unsigned slot = (state >> 33) % LIVE;
+    size_t size = 16 + (state >> 45) % 4080;
+    free(live[slot]);
+    live[slot] = malloc(size);
+    memset(live[slot], 1, size < 64 ? size : 64);
+  }
+  double secs = now_secs() - start;
+  for (unsigned i = 0; i < LIVE; i++) {
+    free(live[i]);
+    live[i] = NULL;
+  }
+  return secs;
+}
+
+static double run(void) {
+  double best = run_once();
+  for (int i = 1; i < RUNS; i++) {
+    double secs = run_once();
+    if (secs < best) {
+      best = secs;
+    }
+  }
+  return best;
+}
+
+// run this program in a child with MYMALLOC_HARDEN set to mode (NULL for
+// unset) and return the time it measured
+static double run_child(char **argv, const char *mode) {
+  int fds[2];
+  assert(pipe(fds) == 0);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    if (mode != NULL) {
+      setenv("MYMALLOC_HARDEN", mode, 1);
+    } else {
+      unsetenv("MYMALLOC_HARDEN");
+    }
+    setenv("BENCH_CHILD", "1", 1);
+    dup2(fds[1], STDOUT_FILENO);
+    execv(argv[0], argv);
+    perror("execv");
+    _exit(1);
+  }
+  close(fds[1]);
+  char buffer[64] = "";
+  ssize_t n = read(fds[0], buffer, sizeof(buffer) - 1);
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+  assert(n > 0);
+  return atof(buffer);
+}
+
+int main(int argc, char **argv) {
+  (void) argc;
+  if (getenv("BENCH_CHILD") != NULL) {
+    printf("%f\n", run());
+    return 0;
+  }
+
+  double off = run_child(argv, NULL);
+  report("malloc/free, hardening off", OPS, off);
+  double checks = run_child(argv, "1");
+  report("malloc/free, MYMALLOC_HARDEN=1", OPS, checks);
+  double guard = run_child(argv, "guard");
+  report("malloc/free, MYMALLOC_HARDEN=guard", OPS, guard);
+  fprintf(stderr, "overhead: %.1f%% with checks, %.1f%% with guard pages\n",
+          100.0 * (checks / off - 1), 100.0 * (guard / off - 1));
+  return 0;
+}
@@ -0,0 +1,112 @@
+// Transparent huge page benchmark
+// times first-touch memset of a 512 MiB buffer, random reads from it and a
+// merge sort of 16M longs, all on large blocks. The run is repeated in a
+// child process started with MYMALLOC_HUGEPAGES=1, so the 2 MiB aligned,
+// MADV_HUGEPAGE mappings can be compared with plain 4 KiB pages. The
+// AnonHugePages line shows whether the kernel actually used huge pages.
+
+#include <malloc.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define BUFFER_BYTES (512UL << 20)
+#define READS (20UL << 20)
+#define SORT_LONGS (16UL << 20)
+
+static unsigned long next_random(unsigned long *state) {
+  *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+  return *state >> 17;
+}
+
+// bottom-up merge sort; after an odd number of passes the result is in tmp
+static void merge_sort(long *data, long *tmp, size_t n) {
+  for (size_t width = 1; width < n; width *= 2) {
+    for (size_t lo = 0; lo < n; lo += 2 * width) {
+      size_t mid = lo + width < n ? lo + width : n;
+      size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+      size_t i = lo, j = mid, k = lo;
+      while (i < mid && j < hi) tmp[k++] = data[i] <= data[j] ? data[i++] : data[j++];
+      while (i < mid) tmp[k++] = data[i++];
+      while (j < hi) tmp[k++] = data[j++];
+    }
+    long *swap = data;
+    data = tmp;
+    tmp = swap;
+  }
+}
+
+static void print_huge_pages(const char *label) {
+  char line[256];
+  FILE *smaps = fopen("/proc/self/smaps_rollup", "r");
+  if (smaps == NULL) return;
+  while (fgets(line, sizeof(line), smaps) != NULL) {
+    if (strncmp(line, "AnonHugePages:", 14) == 0) {
+      fprintf(stderr, "%-36s %s", label, line);
+    }
+  }
+  fclose(smaps);
+}
+
+static void run(const char *label) {
+  char name[64];
+  unsigned long state = 42;
+
+  double start = now_secs();
+  char *buffer = (char *) malloc(BUFFER_BYTES);
+  assert(buffer != NULL);
+  memset(buffer, 1, BUFFER_BYTES);
+  double secs = now_secs() - start;
+  snprintf(name, sizeof(name), "%s memset 512 MiB", label);
+  report(name, BUFFER_BYTES >> 20, secs);
+  print_huge_pages(label);
+
+  unsigned long *words = (unsigned long *) buffer;
+  unsigned long sum = 0;
+  start = now_secs();
+  for (unsigned long i = 0; i < READS; i++) {
+    sum += words[next_random(&state) % (BUFFER_BYTES / sizeof(*words))];
+  }
+  secs = now_secs() - start;
+  assert(sum > 0);
+  snprintf(name, sizeof(name), "%s random reads", label);
+  report(name, READS, secs);
+  free(buffer);
+
+  long *data = (long *) malloc(SORT_LONGS * sizeof(long));
+  long *tmp = (long *) malloc(SORT_LONGS * sizeof(long));
+  assert(data != NULL && tmp != NULL);
+  for (size_t i = 0; i < SORT_LONGS; i++) {
+    data[i] = (long) next_random(&state);
+  }
+  start = now_secs();
+  merge_sort(data, tmp, SORT_LONGS);
+  secs = now_secs() - start;
+  // 24 passes: the sorted run ends up back in data
+  for (size_t i = 1; i < SORT_LONGS; i++) {
+    assert(data[i - 1] <= data[i]);
+  }
+  snprintf(name, sizeof(name), "%s merge sort 16M", label);
+  report(name, SORT_LONGS, secs);
+  free(data);
+  free(tmp);
+}
+
+int main(int argc, char **argv) {
+  (void) argc;
+  if (getenv("MYMALLOC_HUGEPAGES") == NULL) {
+    run("4K pages");
+    fflush(stderr);
+    setenv("MYMALLOC_HUGEPAGES", "1", 1);
+    execv(argv[0], argv);
+    perror("execv");
+    return 1;
+  }
+  run("huge pages");
+  return 0;
+}
@@ -0,0 +1,54 @@
+// Large allocation benchmark
+// runs the allocate, fill, free cycle of a request handler for buffers of
+// 64 KiB to 16 MiB, touching every page of each buffer. The run is repeated
+// in a child process started with MYMALLOC_MAP_CACHE=0, so the cached
+// mappings can be compared with an mmap and munmap per cycle.
+
+#include <malloc.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define TOTAL_BYTES (2UL << 30)  // bytes allocated per size
+#define MIN_CYCLES 64
+
+static void run(const char *label) {
+  long page_size = sysconf(_SC_PAGE_SIZE);
+  for (size_t size = 64UL << 10; size <= 16UL << 20; size *= 4) {
+    unsigned long cycles = TOTAL_BYTES / size;
+    if (cycles < MIN_CYCLES) cycles = MIN_CYCLES;
+
+    double start = now_secs();
+    for (unsigned long i = 0; i < cycles; i++) {
+      char *buffer = (char *) malloc(size);
+      assert(buffer != NULL);
+      for (size_t offset = 0; offset < size; offset += page_size) {
+        buffer[offset] = (char) i;
+      }
+      free(buffer);
+    }
+    double secs = now_secs() - start;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s %zu KiB", label, size >> 10);
+    report(name, cycles, secs);
+  }
+}
+
+int main(int argc, char **argv) {
+  (void) argc;
+  if (getenv("MYMALLOC_MAP_CACHE") == NULL) {
+    run("large cycle, cached");
+    fflush(stderr);
+    setenv("MYMALLOC_MAP_CACHE", "0", 1);
+    execv(argv[0], argv);
+    perror("execv");
+    return 1;
+  }
+  run("large cycle, uncached");
+  return 0;
+}
@@ -0,0 +1,138 @@
+// NUMA locality benchmark
+// a thread pinned to the first node allocates and frees 64 MiB of 256-byte
+// blocks, then a thread pinned to the last node allocates the same amount
+// and measures write and read bandwidth over its blocks, along with the
+// share of their pages that sit on its own node. With per-node arenas the
+// second thread gets fresh local memory; the run is repeated in a child
+// process started with MYMALLOC_ARENAS=1, a single global heap, where it
+// reuses the first thread's (remote) memory. On a single-node machine both
+// threads run on node 0 and the two runs should match.
+
+#define _GNU_SOURCE // CPU_SET, pthread_setaffinity_np
+#include <malloc.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define BLOCK_BYTES 256
+#define BLOCKS ((64 << 20) / BLOCK_BYTES)
+#define READ_PASSES 8
+
+static void *blocks[BLOCKS];
+
+typedef struct {
+  int cpu;
+  int node;
+  int measure;
+} job_t;
+
+// first number in a sysfs list file like "0-3,8", -1 if missing
+static int first_in_list(const char *path, int last) {
+  char list[256] = "";
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return -1;
+  if (fgets(list, sizeof(list), file) == NULL) list[0] = '\0';
+  fclose(file);
+  if (last) {
+    char *p = list + strlen(list);
+    while (p > list && (p[-1] < '0' || p[-1] > '9')) p--;
+    while (p > list && p[-1] >= '0' && p[-1] <= '9') p--;
+    return *p != '\0' ? atoi(p) : -1;
+  }
+  return list[0] != '\0' ? atoi(list) : -1;
+}
+
+static int node_of(void *addr) {
+  int node = -1;
+  if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+    return -1;
+  }
+  return node;
+}
+
+static void *worker(void *arg) {
+  job_t *job = (job_t *) arg;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(job->cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+  double start = now_secs();
+  for (int i = 0; i < BLOCKS; i++) {
+    blocks[i] = malloc(BLOCK_BYTES);
+    memset(blocks[i], i, BLOCK_BYTES);
+  }
+  double write_secs = now_secs() - start;
+
+  if (job->measure) {
+    unsigned long sum = 0;
+    start = now_secs();
+    for (int pass = 0; pass < READ_PASSES; pass++) {
+      for (int i = 0; i < BLOCKS; i++) {
+        const unsigned long *words = (const unsigned long *) blocks[i];
+        for (int j = 0; j < BLOCK_BYTES / 8; j++) sum += words[j];
+      }
+    }
+    double read_secs = now_secs() - start;
+    assert(sum != 0);
+
+    int local = 0, sampled = 0;
+    for (int i = 0; i < BLOCKS; i += 64) {
+      sampled++;
+      local += node_of(blocks[i]) == job->node;
+    }
+    fprintf(stderr, "%-20s cpu %d node %d: write %7.0f MiB/s, read %7.0f MiB/s, %5.1f%% local pages\n",
+            getenv("MYMALLOC_ARENAS") != NULL ? "single global heap" : "per-node arenas",
+            job->cpu, job->node, 64 / write_secs, 64.0 * READ_PASSES / read_secs,
+            100.0 * local / sampled);
+  }
+
+  for (int i = 0; i < BLOCKS; i++) {
+    free(blocks[i]);
+  }
+  return NULL;
+}
+
+static void run_on(int cpu, int node, int measure) {
+  job_t job = {cpu, node, measure};
+  pthread_t tid;
+  pthread_create(&tid, NULL, worker, &job);
+  pthread_join(tid, NULL);
+}
+
+int main(int argc, char **argv) {
+  (void) argc;
+  char path[64];
+  int last_node = first_in_list("/sys/devices/system/node/online", 1);
+  if (last_node < 0) last_node = 0;
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", last_node);
+  int remote_cpu = first_in_list(path, 0);
+  int local_cpu = first_in_list("/sys/devices/system/node/node0/cpulist", 0);
+  if (local_cpu < 0) local_cpu = 0;
+  if (remote_cpu < 0) remote_cpu = local_cpu;
+
+  // fill the heap from node 0, then allocate again from the last node and
+  // from node 0 itself as the local reference
+  run_on(local_cpu, 0, 0);
+  run_on(remote_cpu, last_node, 1);
+  run_on(local_cpu, 0, 1);
+
+  if (getenv("MYMALLOC_ARENAS") == NULL) {
+    fflush(stderr);
+    setenv("MYMALLOC_ARENAS", "1", 1);
+    execv(argv[0], argv);
+    perror("execv");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+
+# Preload benchmark
+# runs real programs from this repository once with glibc malloc and once
+# with libmymalloc.so preloaded, and reports wall time and peak RSS of each
+# run. Programs that have not been built are skipped.
+#
+# usage: tests/bench_preload.py [numbers-to-sort] [shell-commands]
+#
+# nufs is included when NUFS points to a built nufs binary; it is mounted on
+# a temporary directory (this needs FUSE) and a small file workload is run.
+
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+LIBRARY = os.path.join(HERE, "..", "libmymalloc.so")
+TMSORT = os.path.join(HERE, "..", "..", "Concurrent Sorting", "tmsort")
+NUMBERS = os.path.join(HERE, "..", "..", "Concurrent Sorting", "numbers")
+SHELL = os.path.join(HERE, "..", "..", "Project 1 - Shell", "shell")
+
+COUNT = int(sys.argv[1]) if len(sys.argv) > 1 else 2000000
+COMMANDS = int(sys.argv[2]) if len(sys.argv) > 2 else 2000
+
+
+def peak_rss(pid):
+    """ Peak RSS (VmHWM) of a running process in KiB, 0 once it is gone. """
+    try:
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    return 0
+
+
+def run(argv, env, stdin=None, cwd=None):
+    """ Run argv to completion, return (wall seconds, peak RSS in KiB).
+
+    ru_maxrss from wait4 would include the RSS the child inherited from this
+    script before exec, so the child's own high-water mark is polled instead.
+    """
+    start = time.monotonic()
+    proc = subprocess.Popen(argv, env=env, cwd=cwd,
+                            stdin=subprocess.PIPE if stdin is not None else subprocess.DEVNULL,
+                            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    if stdin is not None:
+        proc.stdin.write(stdin)
+        proc.stdin.close()
+    rss = 0
+    while proc.poll() is None:
+        rss = max(rss, peak_rss(proc.pid))
+        time.sleep(0.005)
+    elapsed = time.monotonic() - start
+    if proc.returncode != 0:
+        raise RuntimeError("%s failed with status %d" % (argv[0], proc.returncode))
+    return elapsed, rss
+
+
+def compare(name, argv, library, stdin=None, cwd=None, extra_env=None):
+    for allocator, preload in (("glibc", None), ("mymalloc", library)):
+        env = dict(os.environ, **(extra_env or {}))
+        env.pop("LD_PRELOAD", None)
+        if preload is not None:
+            env["LD_PRELOAD"] = preload
+        secs, rss = run(argv, env, stdin, cwd)
+        print("%-28s %-9s %8.3f s  %8d KiB peak RSS" % (name, allocator, secs, rss))
+
+
+def bench_nufs(nufs, library, workdir):
+    mount = os.path.join(workdir, "mnt")
+    os.mkdir(mount)
+    for allocator, preload in (("glibc", None), ("mymalloc", library)):
+        env = dict(os.environ)
+        env.pop("LD_PRELOAD", None)
+        if preload is not None:
+            env["LD_PRELOAD"] = preload
+        image = os.path.join(workdir, "data-%s.nufs" % allocator)
+        fs = subprocess.Popen([nufs, "-s", "-f", mount, image], env=env,
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        time.sleep(1)
+        rss = 0
+        start = time.monotonic()
+        for i in range(100):
+            path = os.path.join(mount, "file%d.txt" % i)
+            with open(path, "w") as f:
+                f.write("hello %d\n" % i * 20)
+            os.listdir(mount)
+            rss = max(rss, peak_rss(fs.pid))
+        for i in range(100):
+            os.unlink(os.path.join(mount, "file%d.txt" % i))
+        elapsed = time.monotonic() - start
+        rss = max(rss, peak_rss(fs.pid))
+        subprocess.call(["fusermount", "-u", mount])
+        fs.wait()
+        print("%-28s %-9s %8.3f s  %8d KiB peak RSS" %
+              ("nufs create/list/unlink", allocator, elapsed, rss))
+
+
+def main():
+    if not os.path.exists(LIBRARY):
+        sys.exit("libmymalloc.so not found, run make libmymalloc.so first")
+
+    workdir = tempfile.mkdtemp()
+    try:
+        # LD_PRELOAD splits on spaces, and this repository's paths have them
+        library = os.path.join(workdir, "libmymalloc.so")
+        shutil.copy(LIBRARY, library)
+
+        if os.path.exists(TMSORT):
+            # same shuffled input for both runs
+            numbers = os.path.join(workdir, "input.txt")
+            with open(numbers, "w") as f:
+                subprocess.check_call(["bash", NUMBERS, "1", str(COUNT)], stdout=f)
+            for threads in ("1", "4"):
+                compare("tmsort %d numbers, %s thr" % (COUNT, threads),
+                        [TMSORT, numbers], library,
+                        extra_env={"MSORT_THREADS": threads})
+        else:
+            print("tmsort not built, skipping")
+
+        if os.path.exists(SHELL):
+            script = "".join("echo line %d | cat > out.txt\ncat < out.txt\n" % i
+                             for i in range(COMMANDS // 2)) + "exit\n"
+            compare("shell %d commands" % COMMANDS, [SHELL], library,
+                    stdin=script.encode(), cwd=workdir)
+        else:
+            print("shell not built, skipping")
+
+        nufs = os.environ.get("NUFS")
+        if nufs:
+            bench_nufs(nufs, library, workdir)
+        else:
+            print("NUFS not set, skipping nufs")
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
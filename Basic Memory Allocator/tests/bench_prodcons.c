@@ -0,0 +1,91 @@
+// Producer/consumer benchmark
+// every producer thread allocates blocks of random small sizes and passes
+// them through a single-producer/single-consumer ring to its consumer
+// thread, which checks and frees them, so every free is a cross-thread
+// free. reports blocks/sec for 1 to 8 producer/consumer pairs.
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define TOTAL_BLOCKS 2000000
+#define RING_SIZE 1024
+#define MAX_PAIRS 8
+
+typedef struct {
+  void *slots[RING_SIZE];
+  unsigned long head;   // next slot the producer writes
+  unsigned long tail;   // next slot the consumer reads
+  int blocks;           // blocks to pass through the ring
+  unsigned int seed;
+} ring_t;
+
+static ring_t rings[MAX_PAIRS];
+
+static void *producer(void *args) {
+  ring_t *ring = (ring_t *) args;
+  for (int i = 0; i < ring->blocks; i++) {
+    size_t size = 16 + rand_r(&ring->seed) % 497;
+    size_t *block = (size_t *) malloc(size);
+    assert(block != NULL);
+    *block = size;
+
+    unsigned long head = ring->head;
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE) {
+      sched_yield();
+    }
+    ring->slots[head % RING_SIZE] = block;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void *consumer(void *args) {
+  ring_t *ring = (ring_t *) args;
+  for (int i = 0; i < ring->blocks; i++) {
+    unsigned long tail = ring->tail;
+    while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+      sched_yield();
+    }
+    size_t *block = (size_t *) ring->slots[tail % RING_SIZE];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    assert(*block >= 16 && *block <= 512);
+    free(block);
+  }
+  return NULL;
+}
+
+int main() {
+  for (int pairs = 1; pairs <= MAX_PAIRS; pairs *= 2) {
+    pthread_t producers[MAX_PAIRS], consumers[MAX_PAIRS];
+
+    double start = now_secs();
+    for (int i = 0; i < pairs; i++) {
+      rings[i].head = rings[i].tail = 0;
+      rings[i].blocks = TOTAL_BLOCKS / pairs;
+      rings[i].seed = i + 1;
+      pthread_create(&consumers[i], NULL, consumer, &rings[i]);
+      pthread_create(&producers[i], NULL, producer, &rings[i]);
+    }
+    for (int i = 0; i < pairs; i++) {
+      pthread_join(producers[i], NULL);
+      pthread_join(consumers[i], NULL);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%d producer/consumer pair(s)", pairs);
+    report(name, (unsigned long) (TOTAL_BLOCKS / pairs) * pairs, now_secs() - start);
+  }
+  return 0;
+}
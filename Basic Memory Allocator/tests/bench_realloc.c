@@ -0,0 +1,56 @@
+// Realloc doubling benchmark
+// grows one buffer from 16 bytes to 1 GiB by repeated doubling, writing a
+// marker at the start and the end after every step, once with realloc and
+// once with the malloc + memcpy + free a program without realloc would do.
+// Large blocks are resized with mremap, so the realloc run copies no data.
+
+#include <malloc.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define MAX_SIZE (1UL << 30)
+
+static double grow_realloc(void) {
+  double start = now_secs();
+  size_t size = 16;
+  char *buffer = (char *) malloc(size);
+  buffer[0] = 'x';
+  for (; size < MAX_SIZE; size *= 2) {
+    buffer = (char *) realloc(buffer, size * 2);
+    assert(buffer != NULL && buffer[0] == 'x');
+    buffer[size * 2 - 1] = 'y';
+  }
+  free(buffer);
+  return now_secs() - start;
+}
+
+static double grow_copy(void) {
+  double start = now_secs();
+  size_t size = 16;
+  char *buffer = (char *) malloc(size);
+  buffer[0] = 'x';
+  for (; size < MAX_SIZE; size *= 2) {
+    char *bigger = (char *) malloc(size * 2);
+    assert(bigger != NULL);
+    memcpy(bigger, buffer, size);
+    free(buffer);
+    buffer = bigger;
+    assert(buffer[0] == 'x');
+    buffer[size * 2 - 1] = 'y';
+  }
+  free(buffer);
+  return now_secs() - start;
+}
+
+int main() {
+  // 26 doublings from 16 B to 1 GiB
+  double secs = grow_realloc();
+  report("realloc doubling to 1 GiB", 26UL, secs);
+  secs = grow_copy();
+  report("malloc+memcpy doubling to 1 GiB", 26UL, secs);
+  return 0;
+}
@@ -0,0 +1,152 @@
+// Region allocation benchmark
+// tokenizes shell command lines with the rules of the shell's tokenizer and
+// throws the tokens away, over and over. Once every token and the token
+// array are allocated with malloc and freed one by one, once they come
+// from a region that is reset after each line. Both runs must produce the
+// same tokens.
+
+#include <malloc.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+static const char *lines[] = {
+  "ls -l /usr/bin | grep gcc > out.txt",
+  "echo \"hello   world\" ; cat < in.txt | sort | uniq -c",
+  "cd ../Project\\ 2 ; make clean ; make -j4 all",
+  "(prev) ; source script.sh ; help",
+  "find . -name \"*.c\" | xargs wc -l | sort -n | tail -5 > counts",
+};
+
+#define NUM_LINES (sizeof(lines) / sizeof(lines[0]))
+
+typedef struct {
+  char **items;
+  size_t size;
+  size_t capacity;
+} tokens_t;
+
+// the two ways of getting memory: region == NULL means malloc/realloc
+static void *bench_alloc(region_t *region, size_t size) {
+  return region != NULL ? myregion_alloc(region, size) : malloc(size);
+}
+
+static void add_token(tokens_t *tokens, region_t *region, const char *text, size_t len) {
+  if (tokens->size == tokens->capacity) {
+    size_t capacity = tokens->capacity * 2;
+    char **items;
+    if (region != NULL) {
+      items = myregion_alloc(region, capacity * sizeof(char *));
+      memcpy(items, tokens->items, tokens->size * sizeof(char *));
+    } else {
+      items = realloc(tokens->items, capacity * sizeof(char *));
+    }
+    assert(items != NULL);
+    tokens->items = items;
+    tokens->capacity = capacity;
+  }
+  char *token = bench_alloc(region, len + 1);
+  assert(token != NULL);
+  memcpy(token, text, len);
+  token[len] = '\0';
+  tokens->items[tokens->size++] = token;
+}
+
+static int special_char(char c) {
+  return strchr("()<>;|", c) != NULL;
+}
+
+// split a line into words, quoted strings and the special characters ()<>;|
+static tokens_t *tokenize(const char *line, region_t *region) {
+  tokens_t *tokens = bench_alloc(region, sizeof(tokens_t));
+  assert(tokens != NULL);
+  tokens->size = 0;
+  tokens->capacity = 4;
+  tokens->items = bench_alloc(region, tokens->capacity * sizeof(char *));
+  assert(tokens->items != NULL);
+
+  const char *p = line;
+  while (*p != '\0') {
+    if (*p == ' ' || *p == '\t' || *p == '\n') {
+      p++;
+    } else if (special_char(*p)) {
+      add_token(tokens, region, p, 1);
+      p++;
+    } else if (*p == '"') {
+      const char *start = ++p;
+      while (*p != '\0' && *p != '"') {
+        p++;
+      }
+      add_token(tokens, region, start, p - start);
+      if (*p == '"') {
+        p++;
+      }
+    } else {
+      const char *start = p;
+      while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '"' &&
+             !special_char(*p)) {
+        p++;
+      }
+      add_token(tokens, region, start, p - start);
+    }
+  }
+  return tokens;
+}
+
+static void free_tokens(tokens_t *tokens) {
+  for (size_t i = 0; i < tokens->size; i++) {
+    free(tokens->items[i]);
+  }
+  free(tokens->items);
+  free(tokens);
+}
+
+// tokenize every line iterations times, returning the number of tokens
+static unsigned long run_malloc(int iterations, unsigned long *checksum) {
+  unsigned long count = 0;
+  for (int i = 0; i < iterations; i++) {
+    for (size_t l = 0; l < NUM_LINES; l++) {
+      tokens_t *tokens = tokenize(lines[l], NULL);
+      count += tokens->size;
+      *checksum += tokens->items[tokens->size - 1][0];
+      free_tokens(tokens);
+    }
+  }
+  return count;
+}
+
+static unsigned long run_region(int iterations, unsigned long *checksum) {
+  region_t *region = myregion_create();
+  assert(region != NULL);
+  unsigned long count = 0;
+  for (int i = 0; i < iterations; i++) {
+    for (size_t l = 0; l < NUM_LINES; l++) {
+      tokens_t *tokens = tokenize(lines[l], region);
+      count += tokens->size;
+      *checksum += tokens->items[tokens->size - 1][0];
+      myregion_reset(region);
+    }
+  }
+  myregion_destroy(region);
+  return count;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+  unsigned long checksum1 = 0, checksum2 = 0;
+
+  double start = now_secs();
+  unsigned long tokens1 = run_malloc(iterations, &checksum1);
+  report("tokenize, malloc/free per token", tokens1, now_secs() - start);
+
+  start = now_secs();
+  unsigned long tokens2 = run_region(iterations, &checksum2);
+  report("tokenize, region reset per line", tokens2, now_secs() - start);
+
+  assert(tokens1 == tokens2 && checksum1 == checksum2);
+  return 0;
+}
@@ -0,0 +1,126 @@
+// Slab allocator benchmark
+// allocates OBJECTS objects of 16, 32 and 64 bytes with plain malloc and
+// with a slab cache, and reports the resident memory each needed per object
+// and the alloc/free rate (all objects allocated, then all freed, in a
+// shuffled order). Every object is filled and checked before it is freed so
+// overlapping objects are caught.
+
+#include <malloc.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define OBJECTS 200000
+#define ROUNDS 10
+
+static void *objects[OBJECTS];
+static int order[OBJECTS];
+
+/** Resident set size of the process in bytes, from /proc/self/statm. */
+static long resident_bytes(void) {
+  long pages = 0, resident = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm != NULL) {
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(statm);
+  }
+  return resident * sysconf(_SC_PAGE_SIZE);
+}
+
+static void shuffle(void) {
+  for (int i = OBJECTS - 1; i > 0; i--) {
+    int j = rand() % (i + 1);
+    int tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+}
+
+static void fill(void *object, size_t size, int i) {
+  memset(object, (unsigned char) i, size);
+}
+
+static void check(void *object, size_t size, int i) {
+  unsigned char *bytes = (unsigned char *) object;
+  for (size_t b = 0; b < size; b++) {
+    assert(bytes[b] == (unsigned char) i);
+  }
+}
+
+static void bench_malloc(size_t size) {
+  long before = resident_bytes();
+  for (int i = 0; i < OBJECTS; i++) {
+    objects[i] = malloc(size);
+    fill(objects[i], size, i);
+  }
+  double overhead = (double) (resident_bytes() - before) / OBJECTS - size;
+  for (int i = 0; i < OBJECTS; i++) {
+    check(objects[order[i]], size, order[i]);
+    free(objects[order[i]]);
+  }
+
+  double start = now_secs();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < OBJECTS; i++) {
+      objects[i] = malloc(size);
+    }
+    for (int i = 0; i < OBJECTS; i++) {
+      free(objects[order[i]]);
+    }
+  }
+  char name[48];
+  snprintf(name, sizeof(name), "malloc %zu B (%.1f B overhead)", size, overhead);
+  report(name, 2UL * ROUNDS * OBJECTS, now_secs() - start);
+}
+
+static void bench_slab(size_t size) {
+  slab_cache_t *cache = myslab_create(size);
+  assert(cache != NULL);
+
+  long before = resident_bytes();
+  for (int i = 0; i < OBJECTS; i++) {
+    objects[i] = myslab_alloc(cache);
+    fill(objects[i], size, i);
+  }
+  double overhead = (double) (resident_bytes() - before) / OBJECTS - size;
+  for (int i = 0; i < OBJECTS; i++) {
+    check(objects[order[i]], size, order[i]);
+    myslab_free(cache, objects[order[i]]);
+  }
+
+  double start = now_secs();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < OBJECTS; i++) {
+      objects[i] = myslab_alloc(cache);
+    }
+    for (int i = 0; i < OBJECTS; i++) {
+      myslab_free(cache, objects[order[i]]);
+    }
+  }
+  char name[48];
+  snprintf(name, sizeof(name), "slab %zu B (%.1f B overhead)", size, overhead);
+  report(name, 2UL * ROUNDS * OBJECTS, now_secs() - start);
+
+  myslab_destroy(cache);
+}
+
+int main() {
+  srand(3650);
+  for (int i = 0; i < OBJECTS; i++) {
+    order[i] = i;
+  }
+  shuffle();
+
+  for (size_t size = 16; size <= 64; size *= 2) {
+    bench_malloc(size);
+    bench_slab(size);
+  }
+  return 0;
+}
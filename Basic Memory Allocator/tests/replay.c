@@ -0,0 +1,389 @@
+// Trace replay driver
+// runs an allocation trace recorded with MYMALLOC_TRACE against mymalloc
+// (default) or glibc malloc (-g) and reports throughput, latency
+// percentiles, peak RSS and fragmentation.
+//
+// usage: tests/replay [-g] [-t] trace
+//
+// Records are sorted by time and every address is turned into a block id,
+// so a block keeps its id through reallocs and an address reused after a
+// free gets a new one. Frees of blocks the trace never allocated (made
+// before tracing started) are dropped. By default the calls run one after
+// the other in one thread; -t replays every recorded thread in its own
+// thread, where a call on a block waits until the previous call on that
+// block is done. The driver keeps its own data in mmap'd memory so that only
+// the replayed calls go through the allocator under test. Every allocated
+// page is written once, outside the timed call, so the RSS is realistic.
+
+#include <malloc.h>
+// the glibc functions, next to the mymalloc ones the macros pointed to
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+#undef memalign
+#include <stdlib.h>
+extern void *memalign(size_t alignment, size_t size);
+extern struct mallinfo2 { size_t arena, ordblks, smblks, hblks, hblkhd, usmblks,
+                          fsmblks, uordblks, fordblks, keepcost; } mallinfo2(void);
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "trace.h"
+
+typedef struct {
+  uint32_t id;        // block the call works on
+  uint32_t seq;       // calls on this block before this one
+  uint32_t size;
+  uint16_t thread;
+  uint8_t op;         // TRACE_*, realloc of an unknown block becomes malloc
+  uint8_t alignment;  // log2 of a memalign alignment
+} event_t;
+
+typedef struct {
+  void *(*malloc)(size_t);
+  void *(*calloc)(size_t, size_t);
+  void *(*realloc)(void *, size_t);
+  void *(*memalign)(size_t, size_t);
+  void (*free)(void *);
+} allocator_t;
+
+static const allocator_t glibc = { malloc, calloc, realloc, memalign, free };
+static const allocator_t mine = { mymalloc, mycalloc, myrealloc, mymemalign, myfree };
+static const allocator_t *use = &mine;
+
+static const trace_record_t *records;
+static event_t *events;
+static size_t num_events;
+static void **blocks;          // current address of every block id
+static uint32_t *sizes;        // and its requested size
+static uint32_t *done;         // calls finished on every block id
+static uint32_t *latency;      // nanoseconds per event
+static size_t live_bytes, peak_live_bytes;
+static unsigned num_threads;
+
+// helper: zeroed memory straight from the kernel, already resident so it
+// does not count as growth during the replay
+static void *map(size_t length) {
+  void *ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  assert(ptr != MAP_FAILED);
+  return ptr;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// resident set size in KiB from /proc/self/status: the current one or,
+// with peak set, the high-water mark since reset_peak_rss
+static long rss_kib(int peak) {
+  char text[4096];
+  int fd = open("/proc/self/status", O_RDONLY);
+  assert(fd >= 0);
+  ssize_t n = read(fd, text, sizeof(text) - 1);
+  close(fd);
+  text[n > 0 ? n : 0] = '\0';
+  const char *line = strstr(text, peak ? "VmHWM:" : "VmRSS:");
+  return line != NULL ? atol(line + 6) : 0;
+}
+
+static void reset_peak_rss(void) {
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  if (fd >= 0) {
+    assert(write(fd, "5", 1) == 1);
+    close(fd);
+  }
+}
+
+static int by_time(const void *a, const void *b) {
+  const trace_record_t *x = &records[*(const uint32_t *) a];
+  const trace_record_t *y = &records[*(const uint32_t *) b];
+  if (x->nsec != y->nsec) {
+    return x->nsec < y->nsec ? -1 : 1;
+  }
+  return *(const uint32_t *) a < *(const uint32_t *) b ? -1 : 1;
+}
+
+// address to block id map, open addressing; id 0 marks an empty slot
+static uint64_t *keys;
+static uint32_t *values;
+static size_t map_mask;
+
+static size_t slot_of(uint64_t address) {
+  size_t slot = (address >> 4) * 0x9E3779B97F4A7C15UL & map_mask;
+  while (values[slot] != 0 && keys[slot] != address) {
+    slot = (slot + 1) & map_mask;
+  }
+  return slot;
+}
+
+// remove the entry at slot, moving later entries of its run back
+static void map_remove(size_t slot) {
+  values[slot] = 0;
+  for (size_t next = (slot + 1) & map_mask; values[next] != 0; next = (next + 1) & map_mask) {
+    size_t home = (keys[next] >> 4) * 0x9E3779B97F4A7C15UL & map_mask;
+    if (((next - home) & map_mask) >= ((next - slot) & map_mask)) {
+      keys[slot] = keys[next];
+      values[slot] = values[next];
+      values[next] = 0;
+      slot = next;
+    }
+  }
+}
+
+// turn the sorted records into events on block ids. returns the number of
+// block ids used
+static uint32_t build_events(size_t num_records) {
+  uint32_t *order = map(num_records * sizeof(uint32_t));
+  for (size_t i = 0; i < num_records; i++) {
+    order[i] = i;
+  }
+  qsort(order, num_records, sizeof(uint32_t), by_time);
+
+  size_t capacity = 16;
+  while (capacity < 2 * num_records) {
+    capacity *= 2;
+  }
+  keys = map(capacity * sizeof(uint64_t));
+  values = map(capacity * sizeof(uint32_t));
+  map_mask = capacity - 1;
+  uint32_t *calls = map((num_records + 1) * sizeof(uint32_t));
+  events = map(num_records * sizeof(event_t));
+
+  uint32_t next_id = 1;
+  size_t dropped = 0;
+  for (size_t i = 0; i < num_records; i++) {
+    const trace_record_t *record = &records[order[i]];
+    event_t *event = &events[num_events];
+    event->op = record->op;
+    event->size = record->size;
+    event->thread = record->thread;
+    event->alignment = record->op == TRACE_MEMALIGN ? __builtin_ctzl(record->arg) : 0;
+    if (record->thread + 1U > num_threads) {
+      num_threads = record->thread + 1;
+    }
+
+    uint32_t id = 0;
+    if (record->op == TRACE_FREE || (record->op == TRACE_REALLOC && record->arg != 0)) {
+      uint64_t old = record->op == TRACE_FREE ? record->ptr : record->arg;
+      size_t slot = slot_of(old);
+      if (values[slot] != 0) {
+        id = values[slot];
+        map_remove(slot);
+      }
+    }
+    if (id == 0 && record->op == TRACE_FREE) {
+      dropped++;
+      continue;
+    }
+    if (id == 0) {
+      if (record->op == TRACE_REALLOC) {
+        event->op = TRACE_MALLOC;
+      }
+      id = next_id++;
+    }
+    if (record->op != TRACE_FREE) {
+      // an address still mapped belongs to a block whose free raced with
+      // this call; that block is forgotten
+      size_t slot = slot_of(record->ptr);
+      keys[slot] = record->ptr;
+      values[slot] = id;
+    }
+    event->id = id;
+    event->seq = calls[id]++;
+    num_events++;
+  }
+  munmap(order, num_records * sizeof(uint32_t));
+  munmap(calls, (num_records + 1) * sizeof(uint32_t));
+  if (dropped > 0) {
+    fprintf(stderr, "dropped %zu frees of blocks allocated before tracing\n", dropped);
+  }
+  return next_id;
+}
+
+// write one byte in every page of a block, so it becomes resident
+static void touch(char *ptr, size_t size) {
+  for (size_t i = 0; i < size; i += 4096) {
+    ptr[i] = 1;
+  }
+}
+
+static void run_event(size_t i) {
+  event_t *event = &events[i];
+  uint32_t id = event->id;
+  if (num_threads > 1) {
+    while (__atomic_load_n(&done[id], __ATOMIC_ACQUIRE) != event->seq) {
+      sched_yield();
+    }
+  }
+
+  void *ptr = blocks[id];
+  size_t size = event->size;
+  uint64_t start = now_ns();
+  switch (event->op) {
+    case TRACE_MALLOC:
+      ptr = use->malloc(size);
+      break;
+    case TRACE_CALLOC:
+      ptr = use->calloc(1, size);
+      break;
+    case TRACE_REALLOC:
+      ptr = use->realloc(ptr, size);
+      break;
+    case TRACE_MEMALIGN:
+      ptr = use->memalign((size_t) 1 << event->alignment, size);
+      break;
+    case TRACE_FREE:
+      use->free(ptr);
+      ptr = NULL;
+      break;
+  }
+  latency[i] = now_ns() - start;
+
+  size_t old_size = sizes[id];
+  if (ptr != NULL) {
+    if (event->op != TRACE_REALLOC || size > old_size) {
+      touch(ptr, size);
+    }
+    sizes[id] = size;
+  } else {
+    sizes[id] = 0;
+  }
+  blocks[id] = ptr;
+  size_t live = __atomic_add_fetch(&live_bytes, sizes[id] - old_size, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED);
+  while (live > peak && !__atomic_compare_exchange_n(&peak_live_bytes, &peak, live, 1,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+  __atomic_store_n(&done[id], event->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void *replay_thread(void *arg) {
+  unsigned thread = (unsigned) (long) arg;
+  for (size_t i = 0; i < num_events; i++) {
+    if (events[i].thread == thread) {
+      run_event(i);
+    }
+  }
+  return NULL;
+}
+
+static int by_value(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  int threads = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "gt")) != -1) {
+    if (opt == 'g') {
+      use = &glibc;
+    } else if (opt == 't') {
+      threads = 1;
+    } else {
+      fprintf(stderr, "usage: %s [-g] [-t] trace\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-g] [-t] trace\n", argv[0]);
+    return 1;
+  }
+
+  int fd = open(argv[optind], O_RDONLY);
+  if (fd < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+  struct stat st;
+  assert(fstat(fd, &st) == 0);
+  const trace_header_t *header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  assert(header != MAP_FAILED);
+  if ((size_t) st.st_size < sizeof(trace_header_t) ||
+      memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->record_size != sizeof(trace_record_t)) {
+    fprintf(stderr, "%s: not an allocation trace\n", argv[optind]);
+    return 1;
+  }
+  records = (const trace_record_t *) (header + 1);
+  size_t num_records = (st.st_size - sizeof(trace_header_t)) / sizeof(trace_record_t);
+
+  uint32_t num_ids = build_events(num_records);
+  munmap((void *) header, st.st_size);
+  close(fd);
+  blocks = map(num_ids * sizeof(void *));
+  sizes = map(num_ids * sizeof(uint32_t));
+  done = map(num_ids * sizeof(uint32_t));
+  latency = map((num_events + 1) * sizeof(uint32_t));
+  if (!threads) {
+    num_threads = 1;
+  }
+
+  reset_peak_rss();
+  long base_rss = rss_kib(0);
+  double start = now_secs();
+  if (num_threads == 1) {
+    for (size_t i = 0; i < num_events; i++) {
+      run_event(i);
+    }
+  } else {
+    pthread_t *workers = map(num_threads * sizeof(pthread_t));
+    for (unsigned t = 0; t < num_threads; t++) {
+      assert(pthread_create(&workers[t], NULL, replay_thread, (void *) (long) t) == 0);
+    }
+    for (unsigned t = 0; t < num_threads; t++) {
+      pthread_join(workers[t], NULL);
+    }
+  }
+  double secs = now_secs() - start;
+  long peak_rss = rss_kib(1) - base_rss;
+
+  fprintf(stderr, "%s: %zu calls in %u thread%s, %u blocks\n",
+          use == &mine ? "mymalloc" : "glibc", num_events, num_threads,
+          num_threads == 1 ? "" : "s", num_ids - 1);
+  report("replay", num_events, secs);
+
+  qsort(latency, num_events, sizeof(uint32_t), by_value);
+  if (num_events > 0) {
+    fprintf(stderr, "latency ns: p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+            latency[num_events / 2], latency[num_events * 9 / 10],
+            latency[num_events * 99 / 100], latency[num_events * 999 / 1000],
+            latency[num_events - 1]);
+  }
+  fprintf(stderr, "peak RSS %ld KiB for %zu KiB peak live, %zu KiB live at the end\n",
+          peak_rss, peak_live_bytes / 1024, live_bytes / 1024);
+
+  // the heap as the allocator sees it with the blocks left at the end
+  if (use == &mine) {
+    mymalloc_stats_t stats;
+    mymalloc_get_stats(&stats);
+    fprintf(stderr, "mymalloc: %zu KiB mapped, %zu KiB in use, %zu KiB free, fragmentation %.3f\n",
+            stats.mapped / 1024, stats.in_use / 1024, stats.free_bytes / 1024,
+            stats.fragmentation);
+  } else {
+    struct mallinfo2 info = mallinfo2();
+    fprintf(stderr, "glibc: %zu KiB mapped, %zu KiB in use, %zu KiB free, fragmentation %.3f\n",
+            (info.arena + info.hblkhd) / 1024, (info.uordblks + info.hblkhd) / 1024,
+            info.fordblks / 1024,
+            info.arena > 0 ? (double) info.fordblks / info.arena : 0.0);
+  }
+
+  for (uint32_t id = 1; id < num_ids; id++) {
+    use->free(blocks[id]);
+  }
+  return 0;
+}
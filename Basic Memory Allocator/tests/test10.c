@@ -0,0 +1,81 @@
+// Aligned allocation test
+// runs the random-size loops of test6 with aligned_alloc and
+// posix_memalign at random alignments from 32 bytes to 8 pages, checks
+// every address is aligned, fills the blocks, checks freed aligned
+// blocks are reused by later allocations, and checks posix_memalign
+// rejects alignments that are zero, not a power of two or smaller than a
+// pointer
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+int allones = ~0; // allones for int
+
+int *testmemalign(size_t alignment, int size) {
+  int *data = NULL;
+  if (rand() % 2) {
+    data = (int *) aligned_alloc(alignment, size);
+  } else {
+    assert(posix_memalign((void **) &data, alignment, size) == 0);
+  }
+  assert(data != NULL);
+  assert((uintptr_t) data % alignment == 0);
+  memset((void *) data, allones, size);
+  return data;
+}
+
+int main() {
+  fprintf(stderr, 
+      "=======================================================================\n"
+      "Aligned allocation stress test with random sizes from the set {8,\n"
+      "8^2, ..., 8^15} and random alignments from 32 to 32768 bytes. Every\n"
+      "block must be aligned and filled without memory errors, and a freed\n"
+      "small aligned block must be handed out again by the next request.\n"
+      "posix_memalign must fail with EINVAL for an alignment of 0, one that\n"
+      "is not a power of two, or one smaller than a pointer.\n"
+      "=======================================================================\n");
+
+  int i;
+  int *data[8];
+
+  for (i = 0; i < 20001; i++) {
+    for (int j = 0; j < 8; j++) {
+      data[j] = testmemalign(32UL << (rand() % 11), 8 << (rand() % 16));
+    }
+    for (int j = 0; j < 8; j++) {
+      free(data[j]);
+    }
+  }
+
+  // small aligned blocks freed back to the heap are handed out again
+  void *first = NULL, *again = NULL;
+  for (i = 0; i < 1000; i++) {
+    int *small = testmemalign(64, 1000);
+    if (i == 0) {
+      first = small;
+    } else {
+      again = small;
+    }
+    free(small);
+  }
+  assert(first == again);
+
+  // invalid alignments fail with EINVAL and leave *memptr alone
+  size_t invalid[] = { 0, 4, 24, 48, 4097 };
+  for (i = 0; i < (int) (sizeof(invalid) / sizeof(invalid[0])); i++) {
+    void *untouched = &first;
+    assert(posix_memalign(&untouched, invalid[i], 100) == EINVAL);
+    assert(untouched == &first);
+  }
+
+  return 0;
+}
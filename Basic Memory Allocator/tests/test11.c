@@ -0,0 +1,76 @@
+// Statistics test
+// allocates and frees blocks of a few sizes and checks that the counters of
+// mymalloc_get_stats follow along, including counters of a thread that has
+// already exited. Run with MYMALLOC_STATS=1 to also get the at-exit report.
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#define BLOCKS 100
+
+static void *blocks[BLOCKS];
+
+#ifndef DEMO_TEST
+static void *worker(void *unused) {
+  (void) unused;
+  void *large = malloc(1 << 20);
+  free(large);
+  return NULL;
+}
+#endif
+
+int main() {
+  fprintf(stderr, 
+      "=======================================================================\n"
+      "Statistics test. Bytes in use, mapped bytes and the malloc/free, split,\n"
+      "coalesce and mmap counters must follow the allocations of this thread\n"
+      "and of a thread that already exited.\n"
+      "=======================================================================\n");
+
+#ifndef DEMO_TEST
+  mymalloc_stats_t before, during, after;
+  mymalloc_get_stats(&before);
+
+  for (int i = 0; i < BLOCKS; i++) {
+    blocks[i] = malloc(1000);
+  }
+  mymalloc_get_stats(&during);
+  assert(during.in_use >= before.in_use + BLOCKS * 1000);
+  assert(during.mapped >= during.in_use);
+  assert(during.mallocs == before.mallocs + BLOCKS);
+  assert(during.splits > before.splits);
+  assert(during.mmaps > before.mmaps);
+
+  for (int i = 0; i < BLOCKS; i++) {
+    free(blocks[i]);
+  }
+  mymalloc_get_stats(&after);
+  assert(after.in_use == before.in_use);
+  assert(after.frees == before.frees + BLOCKS);
+  assert(after.coalesces > during.coalesces);
+
+  size_t free_blocks = 0;
+  for (int i = 0; i < MYMALLOC_SIZE_CLASSES; i++) {
+    free_blocks += after.free_blocks[i];
+  }
+  assert(free_blocks > 0 && after.free_bytes >= after.largest_free);
+
+  pthread_t tid;
+  pthread_create(&tid, NULL, worker, NULL);
+  pthread_join(tid, NULL);
+  mymalloc_get_stats(&before);
+  assert(before.mallocs == after.mallocs + 1);
+  assert(before.mmaps > after.mmaps);
+
+  mymalloc_print_stats();
+#endif
+
+  return 0;
+}
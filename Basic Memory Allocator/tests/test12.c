@@ -0,0 +1,99 @@
+// Large mapping cache test
+// frees large blocks and allocates them again: the second round must reuse
+// the cached mappings instead of mapping new memory, calloc must still hand
+// out zeroed memory from a reused mapping, and a block too large for the
+// cache must be unmapped right away. Re-runs itself with a known cache size
+// and decay time, so the caller's environment cannot turn the cache off.
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCKS 8
+#define BLOCK_BYTES (1 << 20)
+
+static char *blocks[BLOCKS];
+
+int main(int argc, char **argv) {
+  (void) argc;
+#ifndef DEMO_TEST
+  // the cache reads its settings on first use
+  const char *cache = getenv("MYMALLOC_MAP_CACHE");
+  const char *decay = getenv("MYMALLOC_DECAY_MS");
+  if (cache == NULL || strcmp(cache, "64M") != 0 ||
+      decay == NULL || strcmp(decay, "60000") != 0) {
+    setenv("MYMALLOC_MAP_CACHE", "64M", 1);
+    setenv("MYMALLOC_DECAY_MS", "60000", 1);
+    execv(argv[0], argv);
+    perror("execv");
+    return 1;
+  }
+#else
+  (void) argv;
+#endif
+
+  fprintf(stderr, 
+      "=======================================================================\n"
+      "Large mapping cache test. Freed large blocks are reused without new\n"
+      "mmap calls, calloc still zeroes reused memory and blocks larger than\n"
+      "the cache are unmapped on free.\n"
+      "=======================================================================\n");
+
+#ifndef DEMO_TEST
+  mymalloc_stats_t before, after;
+#endif
+
+  for (int i = 0; i < BLOCKS; i++) {
+    blocks[i] = (char *) malloc(BLOCK_BYTES);
+    memset(blocks[i], 0xab, BLOCK_BYTES);
+  }
+  for (int i = 0; i < BLOCKS; i++) {
+    free(blocks[i]);
+  }
+
+#ifndef DEMO_TEST
+  mymalloc_get_stats(&before);
+  assert(before.map_cache_bytes >= BLOCKS * BLOCK_BYTES);
+#endif
+
+  // slightly smaller requests fit the cached mappings as well
+  for (int i = 0; i < BLOCKS; i++) {
+    blocks[i] = (char *) malloc(BLOCK_BYTES - i * 4096);
+    blocks[i][0] = 1;
+  }
+
+#ifndef DEMO_TEST
+  mymalloc_get_stats(&after);
+  assert(after.mmaps == before.mmaps);
+  assert(after.map_cache_hits == before.map_cache_hits + BLOCKS);
+  assert(after.map_cache_bytes == 0);
+#endif
+
+  for (int i = 0; i < BLOCKS; i++) {
+    free(blocks[i]);
+  }
+
+  char *zeroed = (char *) calloc(1, BLOCK_BYTES);
+  for (int i = 0; i < BLOCK_BYTES; i++) {
+    assert(zeroed[i] == 0);
+  }
+  free(zeroed);
+
+#ifndef DEMO_TEST
+  mymalloc_get_stats(&before);
+  void *huge = malloc(256 << 20);
+  free(huge);
+  mymalloc_get_stats(&after);
+  assert(after.munmaps > before.munmaps);
+  assert(after.map_cache_bytes == before.map_cache_bytes);
+#endif
+
+  return 0;
+}
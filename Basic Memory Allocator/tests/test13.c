@@ -0,0 +1,146 @@
+// Heap profiler test
+// re-runs itself with MYMALLOC_PROFILE=64K, allocates about 4 MB in 1000-byte
+// blocks with malloc, calloc, aligned_alloc, posix_memalign and realloc and
+// checks that the dumped profile accounts for roughly that much with call
+// stacks that start in the test, not in the allocator, that nothing is left
+// after the blocks are freed, that
+// SIGUSR2 writes a numbered profile file, and that the exit dump is empty.
+// The numbered files go to /tmp and are removed.
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BLOCKS 4000
+#define BLOCK_BYTES 1000
+
+static void *blocks[BLOCKS];
+
+// allocate a block with every entry point in turn. every sampled stack must
+// start in here, however many allocator frames each entry point adds
+static __attribute__((noinline)) void *allocate(int i) {
+  void *ptr = NULL;
+  switch (i % 5) {
+  case 0:
+    return malloc(BLOCK_BYTES);
+  case 1:
+    return calloc(1, BLOCK_BYTES);
+  case 2:
+    return aligned_alloc(64, BLOCK_BYTES);
+  case 3:
+    return posix_memalign(&ptr, 64, BLOCK_BYTES) == 0 ? ptr : NULL;
+  default:
+    return realloc(malloc(16), BLOCK_BYTES);
+  }
+}
+
+#ifndef DEMO_TEST
+// follows allocate, so the code of allocate ends here (tests build at -O0,
+// which keeps functions in source order)
+static __attribute__((noinline)) void allocate_end(void) {
+}
+
+// in-use bytes from the header of a profile, and the number of stack lines.
+// the first frame of every stack has to be in allocate
+static unsigned long read_profile(const char *path, int *stacks) {
+  char line[4096];
+  unsigned long objects = 0, bytes = 0;
+  FILE *file = fopen(path, "r");
+  assert(file != NULL);
+  assert(fgets(line, sizeof(line), file) != NULL);
+  assert(sscanf(line, "heap profile: %lu: %lu", &objects, &bytes) == 2);
+  *stacks = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char *frames = strstr(line, "] @ 0x");
+    if (frames != NULL) {
+      char *first = (char *) strtoul(frames + 4, NULL, 16);
+      assert(first > (char *) allocate && first < (char *) allocate_end);
+      (*stacks)++;
+    }
+  }
+  fclose(file);
+  return bytes;
+}
+#endif
+
+int main(int argc, char **argv) {
+  (void) argc;
+#ifndef DEMO_TEST
+  // the profiler reads its settings before main runs. the child's exit dump
+  // is checked and removed once it has finished
+  if (getenv("MYMALLOC_PROFILE") == NULL) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      setenv("MYMALLOC_PROFILE", "64K", 1);
+      setenv("MYMALLOC_PROFILE_FILE", "/tmp/mymalloc-test13", 1);
+      execv(argv[0], argv);
+      perror("execv");
+      _exit(1);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    char path[64];
+    int stacks;
+    snprintf(path, sizeof(path), "/tmp/mymalloc-test13.%d.1.heap", (int) pid);
+    assert(read_profile(path, &stacks) == 0 && stacks == 0);
+    unlink(path);
+    return 0;
+  }
+#else
+  (void) argv;
+#endif
+
+  fprintf(stderr, 
+      "=======================================================================\n"
+      "Heap profiler test. About 4 MB of live blocks from every allocation\n"
+      "function show up in the sampled profile with call stacks that start in\n"
+      "the test, freed blocks drop out of it, and SIGUSR2 writes a profile\n"
+      "file.\n"
+      "=======================================================================\n");
+
+  for (int i = 0; i < BLOCKS; i++) {
+    blocks[i] = allocate(i);
+    assert(blocks[i] != NULL);
+  }
+
+#ifndef DEMO_TEST
+  int stacks;
+  assert(mymalloc_dump_profile("tests/test13.heap") == 0);
+  unsigned long bytes = read_profile("tests/test13.heap", &stacks);
+  fprintf(stderr, "profiled %lu of %d live bytes in %d samples\n",
+          bytes, BLOCKS * BLOCK_BYTES, stacks);
+  assert(bytes > BLOCKS * BLOCK_BYTES / 2 && bytes < BLOCKS * BLOCK_BYTES * 2);
+  assert(stacks > 10);
+#endif
+
+  for (int i = 0; i < BLOCKS; i++) {
+    free(blocks[i]);
+  }
+
+#ifndef DEMO_TEST
+  assert(mymalloc_dump_profile("tests/test13.heap") == 0);
+  assert(read_profile("tests/test13.heap", &stacks) == 0 && stacks == 0);
+  unlink("tests/test13.heap");
+
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/mymalloc-test13.%d.0.heap", (int) getpid());
+  raise(SIGUSR2);
+  assert(access(path, R_OK) == 0);
+  unlink(path);
+#endif
+
+  return 0;
+}
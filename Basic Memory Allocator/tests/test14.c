@@ -0,0 +1,164 @@
+// Hardened mode test
+// re-runs itself with MYMALLOC_HARDEN=guard, checks that a mixed workload of
+// malloc, realloc, posix_memalign and free runs clean, then makes forked children
+// overflow a block, free twice, free a bad pointer, overwrite a freed
+// block's free-list link and run past a large block, and checks that each
+// one is stopped by the allocator.
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <assert.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BLOCKS 1000
+#define ROUNDS 20000
+
+static unsigned char *blocks[BLOCKS];
+static size_t sizes[BLOCKS];
+
+// fill a block with a pattern derived from its slot
+static void fill(int slot) {
+  memset(blocks[slot], slot & 0xff, sizes[slot]);
+}
+
+static void check(int slot) {
+  for (size_t i = 0; i < sizes[slot]; i++) {
+    assert(blocks[slot][i] == (slot & 0xff));
+  }
+}
+
+static void workload(void) {
+  srand(3650);
+  for (int round = 0; round < ROUNDS; round++) {
+    int slot = rand() % BLOCKS;
+    if (blocks[slot] != NULL) {
+      check(slot);
+    }
+    size_t size = rand() % 8 == 0 ? 1 + rand() % 300000 : 1 + rand() % 1024;
+    switch (rand() % 3) {
+      case 0:
+        free(blocks[slot]);
+        blocks[slot] = malloc(size);
+        break;
+      case 1:
+        blocks[slot] = realloc(blocks[slot], size);
+        if (sizes[slot] < size && blocks[slot] != NULL) {
+          memset(blocks[slot] + sizes[slot], slot & 0xff, size - sizes[slot]);
+        }
+        break;
+      default:
+        free(blocks[slot]);
+        assert(posix_memalign((void **) &blocks[slot], 64, size) == 0);
+        assert(((uintptr_t) blocks[slot] & 63) == 0);
+        break;
+    }
+    assert(blocks[slot] != NULL);
+#ifndef DEMO_TEST
+    assert(malloc_usable_size(blocks[slot]) >= size);
+#endif
+    sizes[slot] = size;
+    fill(slot);
+  }
+  for (int i = 0; i < BLOCKS; i++) {
+    check(i);
+    free(blocks[i]);
+    blocks[i] = NULL;
+  }
+}
+
+#ifndef DEMO_TEST
+// run bad in a child and check that it is killed by signal
+static void expect_killed(const char *name, void (*bad)(void), int signal) {
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    // the abort message is expected, keep the test output clean
+    freopen("/dev/null", "w", stderr);
+    bad();
+    _exit(0);
+  }
+  int status;
+  assert(waitpid(pid, &status, 0) == pid);
+  fprintf(stderr, "%-32s %s\n", name,
+          WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) : "not detected");
+  assert(WIFSIGNALED(status) && WTERMSIG(status) == signal);
+}
+
+static void overflow(void) {
+  char *ptr = malloc(40);
+  memset(ptr, 'x', malloc_usable_size(ptr) + 1);
+  free(ptr);
+}
+
+static void double_free(void) {
+  void *ptr = malloc(100);
+  free(ptr);
+  free(ptr);
+}
+
+static void bad_pointer(void) {
+  char *ptr = malloc(100);
+  free(ptr + 16);
+}
+
+static void use_after_free(void) {
+  void *first = malloc(64);
+  void *second = malloc(64);
+  free(second);
+  free(first);
+  // flip a bit of the link first keeps to second
+  *(uintptr_t *) first ^= 1;
+  first = malloc(64);
+  second = malloc(64);
+}
+
+static void large_overflow(void) {
+  char *ptr = malloc(100000);
+  // the canary sits between the usable bytes and the guard page
+  ptr[malloc_usable_size(ptr) + sizeof(uint64_t)] = 'x';
+}
+#endif
+
+int main(int argc, char **argv) {
+  (void) argc;
+#ifndef DEMO_TEST
+  if (getenv("MYMALLOC_HARDEN") == NULL) {
+    setenv("MYMALLOC_HARDEN", "guard", 1);
+    execv(argv[0], argv);
+    perror("execv");
+    return 1;
+  }
+#else
+  (void) argv;
+#endif
+
+  fprintf(stderr,
+      "=======================================================================\n"
+      "Hardened mode test. A mixed workload runs clean with checksums,\n"
+      "canaries, encoded links and guard pages, and overflows, double and\n"
+      "bad frees and a corrupted free list abort the program.\n"
+      "=======================================================================\n");
+
+  workload();
+
+#ifndef DEMO_TEST
+  expect_killed("overflow into the canary", overflow, SIGABRT);
+  expect_killed("double free", double_free, SIGABRT);
+  expect_killed("free of a bad pointer", bad_pointer, SIGABRT);
+  expect_killed("corrupted free-list link", use_after_free, SIGABRT);
+  if (strcmp(getenv("MYMALLOC_HARDEN"), "guard") == 0) {
+    expect_killed("write into a guard page", large_overflow, SIGSEGV);
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,155 @@
+// Fork stress test
+// worker threads allocate and free blocks of all sizes, some of them freed
+// by another thread and some from a slab cache, while other threads fork
+// over and over. Every child allocates, frees the blocks the workers set
+// aside before the forks, reads the statistics and exits; a child stuck on
+// a lock another thread held at fork time is killed by an alarm and fails
+// the test.
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define WORKERS 8
+#define FORKERS 4
+#define FORKS 50
+#define KEPT 100
+#define WINDOW 64
+
+static volatile int stop = 0;
+static void *kept[WORKERS][KEPT];
+static void *volatile handoff[WORKERS];
+#ifndef DEMO_TEST
+static slab_cache_t *cache;
+#endif
+
+static void *worker(void *arg) {
+  long id = (long) arg;
+  unsigned seed = id;
+  void *window[WINDOW] = { NULL };
+
+  // blocks that stay cached or owned by this thread for the children to free
+  for (int i = 0; i < KEPT; i++) {
+    kept[id][i] = malloc(16 + rand_r(&seed) % 512);
+    assert(kept[id][i] != NULL);
+  }
+
+  while (!stop) {
+    int slot = rand_r(&seed) % WINDOW;
+    free(window[slot]);
+    size_t size = rand_r(&seed) % 16 == 0 ? 4096 + rand_r(&seed) % 100000
+                                          : 16 + rand_r(&seed) % 2048;
+    window[slot] = malloc(size);
+    assert(window[slot] != NULL);
+    memset(window[slot], (int) id, size < 64 ? size : 64);
+
+    // pass a block to the next worker, which frees it
+    void *mine = malloc(48);
+    void *theirs = __atomic_exchange_n(&handoff[(id + 1) % WORKERS], mine, __ATOMIC_ACQ_REL);
+    free(theirs);
+#ifndef DEMO_TEST
+    myslab_free(cache, myslab_alloc(cache));
+#endif
+  }
+  for (int i = 0; i < WINDOW; i++) {
+    free(window[i]);
+  }
+  return NULL;
+}
+
+static void child(void) {
+  alarm(10);
+  void *blocks[1000];
+  for (int i = 0; i < 1000; i++) {
+    blocks[i] = malloc(i % 10 == 0 ? 8192 : 16 + i % 1000);
+    assert(blocks[i] != NULL);
+  }
+  for (int i = 0; i < 1000; i++) {
+    free(blocks[i]);
+  }
+  for (int w = 0; w < WORKERS; w++) {
+    for (int i = 0; i < KEPT; i++) {
+      free(kept[w][i]);
+    }
+  }
+#ifndef DEMO_TEST
+  void *object = myslab_alloc(cache);
+  assert(object != NULL);
+  myslab_free(cache, object);
+  mymalloc_stats_t stats;
+  mymalloc_get_stats(&stats);
+  assert(stats.mallocs >= stats.frees);
+#endif
+  _exit(0);
+}
+
+static void *forker(void *arg) {
+  (void) arg;
+  for (int i = 0; i < FORKS; i++) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      child();
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "child %d failed: %s\n", (int) pid,
+              WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) : "exit status");
+      abort();
+    }
+  }
+  return NULL;
+}
+
+int main(void) {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "Fork stress test. %d threads fork %d times each while %d threads\n"
+      "allocate; every child can allocate and free without deadlocking.\n"
+      "=======================================================================\n",
+      FORKERS, FORKS, WORKERS);
+
+#ifndef DEMO_TEST
+  cache = myslab_create(40);
+  assert(cache != NULL);
+#endif
+  pthread_t workers[WORKERS], forkers[FORKERS];
+  for (long i = 0; i < WORKERS; i++) {
+    assert(pthread_create(&workers[i], NULL, worker, (void *) i) == 0);
+  }
+  // let the workers set their blocks aside before the first fork
+  sleep(1);
+  for (int i = 0; i < FORKERS; i++) {
+    assert(pthread_create(&forkers[i], NULL, forker, NULL) == 0);
+  }
+  for (int i = 0; i < FORKERS; i++) {
+    pthread_join(forkers[i], NULL);
+  }
+  stop = 1;
+  for (int i = 0; i < WORKERS; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  for (int i = 0; i < WORKERS; i++) {
+    free(handoff[i]);
+    for (int j = 0; j < KEPT; j++) {
+      free(kept[i][j]);
+    }
+  }
+#ifndef DEMO_TEST
+  myslab_destroy(cache);
+#endif
+  fprintf(stderr, "%d children ran clean\n", FORKERS * FORKS);
+  return 0;
+}
@@ -0,0 +1,182 @@
+// Allocation trace test
+// re-runs itself with MYMALLOC_TRACE set to record a known sequence of
+// malloc, calloc, realloc, posix_memalign and free calls in two threads,
+// then reads the trace back and checks the header, the number of records of
+// each kind, their sizes and thread numbers, and that every freed address
+// was returned by an earlier call.
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef DEMO_TEST
+#include "trace.h"
+#endif
+
+#define THREADS 2
+#define BLOCKS 500
+#define TRACE_PATH "/tmp/mymalloc-test16.trace"
+
+// the traced calls of one thread: per block a malloc, a calloc, a realloc
+// and a posix_memalign, and a free of each result
+static void *workload(void *arg) {
+  (void) arg;
+  static __thread void *blocks[BLOCKS][3];
+  for (int i = 0; i < BLOCKS; i++) {
+    blocks[i][0] = malloc(16 + i);
+    blocks[i][1] = calloc(1, 1000 + i);
+    assert(posix_memalign(&blocks[i][2], 64, 100) == 0);
+    assert(blocks[i][0] != NULL && blocks[i][1] != NULL);
+  }
+  for (int i = 0; i < BLOCKS; i++) {
+    blocks[i][0] = realloc(blocks[i][0], 5000 + i);
+    assert(blocks[i][0] != NULL);
+    for (int j = 0; j < 3; j++) {
+      free(blocks[i][j]);
+    }
+  }
+  return NULL;
+}
+
+static void record(void) {
+  pthread_t threads[THREADS];
+  for (int t = 0; t < THREADS; t++) {
+    assert(pthread_create(&threads[t], NULL, workload, NULL) == 0);
+  }
+  for (int t = 0; t < THREADS; t++) {
+    pthread_join(threads[t], NULL);
+  }
+}
+
+#ifndef DEMO_TEST
+static int by_time(const void *a, const void *b) {
+  const trace_record_t *x = a, *y = b;
+  return (x->nsec > y->nsec) - (x->nsec < y->nsec);
+}
+
+// check that the last record before i that mentions the address freed by
+// records[i] returned it, rather than freed it
+static int allocated(const trace_record_t *records, size_t i) {
+  uint64_t ptr = records[i].ptr;
+  while (i-- > 0) {
+    if (records[i].op != TRACE_FREE && records[i].ptr == ptr) {
+      return 1;
+    }
+    if (records[i].op == TRACE_FREE ? records[i].ptr == ptr : records[i].arg == ptr) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+static void check_trace(void) {
+  FILE *file = fopen(TRACE_PATH, "r");
+  assert(file != NULL);
+  trace_header_t header;
+  assert(fread(&header, sizeof(header), 1, file) == 1);
+  assert(memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0);
+  assert(header.record_size == sizeof(trace_record_t));
+
+  size_t capacity = 1000, count = 0;
+  trace_record_t *records = malloc(capacity * sizeof(trace_record_t));
+  while (fread(&records[count], sizeof(trace_record_t), 1, file) == 1) {
+    if (++count == capacity) {
+      capacity *= 2;
+      records = realloc(records, capacity * sizeof(trace_record_t));
+    }
+  }
+  fclose(file);
+  qsort(records, count, sizeof(trace_record_t), by_time);
+
+  // the child's own calls (stdio, thread stacks, ...) are in the trace too,
+  // so count only the ones with the sizes the workload uses
+  size_t ops[TRACE_FREE + 1] = {0};
+  unsigned threads_seen = 0;
+  for (size_t i = 0; i < count; i++) {
+    trace_record_t *r = &records[i];
+    assert(r->op >= TRACE_MALLOC && r->op <= TRACE_FREE);
+    assert(r->thread < 16);
+    threads_seen |= 1U << r->thread;
+    switch (r->op) {
+      case TRACE_MALLOC:
+        ops[r->op] += r->size >= 16 && r->size < 16 + BLOCKS;
+        break;
+      case TRACE_CALLOC:
+        ops[r->op] += r->size >= 1000 && r->size < 1000 + BLOCKS;
+        break;
+      case TRACE_REALLOC:
+        assert(r->arg != 0);
+        ops[r->op] += r->size >= 5000 && r->size < 5000 + BLOCKS;
+        break;
+      case TRACE_MEMALIGN:
+        assert(r->arg == 64 && r->size == 100 && r->ptr % 64 == 0);
+        ops[r->op]++;
+        break;
+      case TRACE_FREE:
+        assert(allocated(records, i));
+        ops[r->op]++;
+        break;
+    }
+  }
+  fprintf(stderr, "%zu records: %zu malloc %zu calloc %zu realloc %zu memalign %zu free\n",
+          count, ops[TRACE_MALLOC], ops[TRACE_CALLOC], ops[TRACE_REALLOC],
+          ops[TRACE_MEMALIGN], ops[TRACE_FREE]);
+  assert(ops[TRACE_MALLOC] >= THREADS * BLOCKS);
+  assert(ops[TRACE_CALLOC] == THREADS * BLOCKS);
+  assert(ops[TRACE_REALLOC] == THREADS * BLOCKS);
+  assert(ops[TRACE_MEMALIGN] == THREADS * BLOCKS);
+  assert(ops[TRACE_FREE] >= 3 * THREADS * BLOCKS);
+  // both workers have their own thread number
+  assert(__builtin_popcount(threads_seen) >= THREADS);
+  free(records);
+}
+#endif
+
+int main(int argc, char **argv) {
+  (void) argc;
+#ifndef DEMO_TEST
+  if (getenv("MYMALLOC_TRACE") != NULL) {
+    record();
+    return 0;
+  }
+#else
+  (void) argv;
+#endif
+
+  fprintf(stderr,
+      "=======================================================================\n"
+      "Allocation trace test. A child records malloc, calloc, realloc,\n"
+      "memalign and free calls in two threads with MYMALLOC_TRACE, and every\n"
+      "call shows up in the trace with its size, thread and address.\n"
+      "=======================================================================\n");
+
+#ifndef DEMO_TEST
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    setenv("MYMALLOC_TRACE", TRACE_PATH, 1);
+    execv(argv[0], argv);
+    perror("execv");
+    _exit(1);
+  }
+  int status;
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  check_trace();
+  unlink(TRACE_PATH);
+#else
+  record();
+#endif
+  return 0;
+}
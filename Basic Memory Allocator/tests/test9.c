@@ -0,0 +1,79 @@
+// Realloc test
+// grows and shrinks blocks of small and large sizes with realloc and checks
+// that the contents up to the smaller of the old and new size survive every
+// resize, including growing into a freed neighbour
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static void fill(unsigned char *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (unsigned char) (i * 7);
+  }
+}
+
+static void check(unsigned char *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    assert(data[i] == (unsigned char) (i * 7));
+  }
+}
+
+int main() {
+  fprintf(stderr, 
+      "=======================================================================\n"
+      "Realloc test. Blocks are grown from 8 bytes to 2^24 bytes and shrunk\n"
+      "back, and the contents are checked after every resize. You should not\n"
+      "get any memory error or assertion error.\n"
+      "=======================================================================\n");
+
+  // grow by doubling, across the small/large boundary
+  size_t size = 8;
+  unsigned char *data = (unsigned char *) realloc(NULL, size);
+  fill(data, size);
+  for (; size < (1UL << 24); size *= 2) {
+    data = (unsigned char *) realloc(data, size * 2);
+    assert(data != NULL);
+    check(data, size);
+    fill(data, size * 2);
+  }
+
+  // shrink back by halving
+  for (; size > 8; size /= 2) {
+    data = (unsigned char *) realloc(data, size / 2);
+    assert(data != NULL);
+    check(data, size / 2);
+  }
+  free(data);
+
+  // grow into a neighbour that was freed right after it
+  unsigned char *first = (unsigned char *) malloc(600);
+  unsigned char *second = (unsigned char *) malloc(600);
+  unsigned char *third = (unsigned char *) malloc(600);
+  fill(first, 600);
+  fill(third, 600);
+  free(second);
+  first = (unsigned char *) realloc(first, 1200);
+  assert(first != NULL);
+  check(first, 600);
+  fill(first, 1200);
+  check(third, 600);
+
+  // shrinking keeps the start of the block
+  first = (unsigned char *) realloc(first, 100);
+  check(first, 100);
+  free(first);
+  free(third);
+
+  // realloc to 0 frees the block
+  data = (unsigned char *) malloc(64);
+  assert(realloc(data, 0) == NULL);
+
+  return 0;
+}
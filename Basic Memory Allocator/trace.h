@@ -0,0 +1,39 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/* Binary allocation trace, written by mymalloc when MYMALLOC_TRACE names a
+ * file and read by tests/replay. The file is a trace_header_t followed by
+ * fixed-size records. Each thread buffers its records and writes them in
+ * batches, so records are ordered by thread, not by time; readers sort them
+ * by nsec.
+ */
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "MMTRACE1"
+
+enum {
+  TRACE_MALLOC = 1,   /* ptr = malloc(size) */
+  TRACE_CALLOC,       /* ptr = calloc(1, size) */
+  TRACE_REALLOC,      /* ptr = realloc(arg, size) */
+  TRACE_MEMALIGN,     /* ptr = memalign(arg, size) */
+  TRACE_FREE,         /* free(ptr) */
+};
+
+typedef struct {
+  char magic[8];      /* TRACE_MAGIC */
+  uint32_t record_size;
+  uint32_t reserved;
+} trace_header_t;
+
+typedef struct {
+  uint64_t nsec;      /* time since tracing started */
+  uint64_t ptr;       /* block returned, or freed */
+  uint64_t arg;       /* old block of a realloc, alignment of a memalign */
+  uint32_t size;      /* bytes requested, at most UINT32_MAX */
+  uint16_t thread;    /* thread number, in the order threads first traced */
+  uint8_t op;         /* TRACE_* */
+  uint8_t reserved;
+} trace_record_t;
+
+#endif /* ifndef _TRACE_H */
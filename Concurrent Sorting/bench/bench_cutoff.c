@@ -0,0 +1,91 @@
+/**
+ * Cutoff Benchmark
+ *
+ * Sorts count random numbers (default 10M) on one thread with the merge
+ * sort of msort and tmsort, insertion sorting slices of at most cutoff
+ * elements, for cutoffs from 1 (plain merge sort) to 128. Prints the best
+ * of five runs for every cutoff and the fastest cutoff, which can be passed
+ * to msort and tmsort in MSORT_CUTOFF or made the DEFAULT_CUTOFF.
+ *
+ * Usage: bench/bench_cutoff [count]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <assert.h>
+
+#include "merge.h"
+#include "smallsort.h"
+
+#define RUNS 5
+
+static const int cutoffs[] = { 1, 2, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128 };
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * The recursion of msort: sorts nums[from, to) into target
+ */
+static void merge_sort_aux(long nums[], int from, int to, long target[]) {
+    if (to - from <= sort_cutoff) {
+        insertion_sort(target, from, to);
+        return;
+    }
+
+    int mid = (from + to) / 2;
+    merge_sort_aux(target, from, mid, nums);
+    merge_sort_aux(target, mid, to, nums);
+    merge(nums, from, mid, to, target);
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 10000000;
+
+    long *input = malloc(count * sizeof(long));
+    long *nums = malloc(count * sizeof(long));
+    long *target = malloc(count * sizeof(long));
+    assert(input != NULL && nums != NULL && target != NULL);
+    srand(3650);
+    for (int i = 0; i < count; i++) {
+        input[i] = ((long)rand() << 31) ^ rand();
+    }
+
+    printf("%8s %10s %8s\n", "cutoff", "best (s)", "speedup");
+    double plain = 0;
+    double fastest = 1e9;
+    int best_cutoff = 1;
+    for (size_t c = 0; c < sizeof(cutoffs) / sizeof(cutoffs[0]); c++) {
+        sort_cutoff = cutoffs[c];
+        double best = 1e9;
+        for (int run = 0; run < RUNS; run++) {
+            memcpy(nums, input, count * sizeof(long));
+            memcpy(target, input, count * sizeof(long));
+            double start = now_secs();
+            merge_sort_aux(nums, 0, count, target);
+            double secs = now_secs() - start;
+            best = secs < best ? secs : best;
+        }
+        for (int i = 1; i < count; i++) {
+            assert(target[i - 1] <= target[i]);
+        }
+
+        plain = c == 0 ? best : plain;
+        if (best < fastest) {
+            fastest = best;
+            best_cutoff = sort_cutoff;
+        }
+        printf("%8d %10.3f %8.2f\n", sort_cutoff, best, plain / best);
+    }
+    printf("best cutoff: %d\n", best_cutoff);
+
+    free(input);
+    free(nums);
+    free(target);
+    return 0;
+}
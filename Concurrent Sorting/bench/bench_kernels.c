@@ -0,0 +1,131 @@
+/**
+ * Merge Kernel Benchmark
+ *
+ * Compares the merge kernels of merge.c on random, presorted and
+ * reverse-sorted data of count numbers (default 10M): first the merge of the
+ * two sorted halves alone, then a whole single-threaded merge sort. For
+ * presorted data every element of the left half is smaller than the right
+ * half; for reverse-sorted data it is larger. Prints the best of three runs;
+ * kernels the CPU does not support are skipped.
+ *
+ * Usage: bench/bench_kernels [count]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <assert.h>
+
+#include "merge.h"
+#include "smallsort.h"
+
+#define RUNS 3
+
+static const char *kernels[] = { "branchy", "branchless", "avx2", "avx512" };
+static const char *orders[] = { "random", "presorted", "reverse" };
+
+#define KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+#define ORDERS (sizeof(orders) / sizeof(orders[0]))
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Fill input with count numbers in the given order
+ */
+static void fill(long *input, int count, const char *order) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(order, "random") == 0) {
+            input[i] = ((long)rand() << 31) ^ rand();
+        }
+        else if (strcmp(order, "presorted") == 0) {
+            input[i] = i;
+        }
+        else {
+            input[i] = count - i;
+        }
+    }
+}
+
+static int compare(const void *x, const void *y) {
+    long a = *(const long *)x;
+    long b = *(const long *)y;
+    return (a > b) - (a < b);
+}
+
+/**
+ * The recursion of msort: sorts nums[from, to) into target
+ */
+static void merge_sort_aux(long nums[], int from, int to, long target[]) {
+    if (to - from <= sort_cutoff) {
+        insertion_sort(target, from, to);
+        return;
+    }
+
+    int mid = (from + to) / 2;
+    merge_sort_aux(target, from, mid, nums);
+    merge_sort_aux(target, mid, to, nums);
+    merge(nums, from, mid, to, target);
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 10000000;
+    int mid = count / 2;
+
+    long *input = malloc(count * sizeof(long));
+    long *halves = malloc(count * sizeof(long));
+    long *nums = malloc(count * sizeof(long));
+    long *target = malloc(count * sizeof(long));
+    long *expected = malloc(count * sizeof(long));
+    assert(input != NULL && halves != NULL && nums != NULL && target != NULL && expected != NULL);
+
+    printf("%-12s %-10s %10s %10s\n", "kernel", "data", "merge (s)", "sort (s)");
+    for (size_t o = 0; o < ORDERS; o++) {
+        srand(3650);
+        fill(input, count, orders[o]);
+        memcpy(halves, input, count * sizeof(long));
+        qsort(halves, mid, sizeof(long), compare);
+        qsort(halves + mid, count - mid, sizeof(long), compare);
+        memcpy(expected, input, count * sizeof(long));
+        qsort(expected, count, sizeof(long), compare);
+
+        for (size_t k = 0; k < KERNELS; k++) {
+            merge_kernel_t *kernel = find_merge_kernel(kernels[k]);
+            if (kernel == NULL) {
+                printf("%-12s %-10s %10s %10s\n", kernels[k], orders[o], "-", "-");
+                continue;
+            }
+            use_merge_kernel(kernels[k]);
+
+            double best_merge = 1e9;
+            double best_sort = 1e9;
+            for (int run = 0; run < RUNS; run++) {
+                double start = now_secs();
+                kernel(halves, mid, halves + mid, count - mid, target);
+                double secs = now_secs() - start;
+                best_merge = secs < best_merge ? secs : best_merge;
+                assert(memcmp(target, expected, count * sizeof(long)) == 0);
+
+                memcpy(nums, input, count * sizeof(long));
+                memcpy(target, input, count * sizeof(long));
+                start = now_secs();
+                merge_sort_aux(nums, 0, count, target);
+                secs = now_secs() - start;
+                best_sort = secs < best_sort ? secs : best_sort;
+                assert(memcmp(target, expected, count * sizeof(long)) == 0);
+            }
+            printf("%-12s %-10s %10.4f %10.3f\n", kernels[k], orders[o], best_merge, best_sort);
+        }
+    }
+
+    free(input);
+    free(halves);
+    free(nums);
+    free(target);
+    free(expected);
+    return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * Merge Benchmark
+ *
+ * Merges two sorted halves of count random numbers (default 100M, the size
+ * of the last merge of the experiments.md dataset) with merge on one thread,
+ * then with parallel_merge on pools of 1, 2, 4, ... up to max_threads
+ * threads (default: the number of cores). Prints the best of three runs and
+ * checks every result against the serial one.
+ *
+ * Usage: bench/bench_merge [count] [max_threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <assert.h>
+#include <unistd.h>
+
+#include "merge.h"
+#include "pool.h"
+
+#define RUNS 3
+
+static long *nums;
+static long *target;
+static int count;
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Fill both halves with ascending random numbers of the same range
+ */
+static void fill_halves(void) {
+    int mid = count / 2;
+    long value = 0;
+    for (int i = 0; i < mid; i++) {
+        value += rand() % 64;
+        nums[i] = value;
+    }
+    value = 0;
+    for (int i = mid; i < count; i++) {
+        value += rand() % 64;
+        nums[i] = value;
+    }
+}
+
+static void merge_all(void *arg) {
+    (void)arg;
+    parallel_merge(nums, 0, count / 2, count, target);
+}
+
+int main(int argc, char **argv) {
+    count = argc > 1 ? atoi(argv[1]) : 100000000;
+    int max_threads = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    nums = malloc(count * sizeof(long));
+    target = malloc(count * sizeof(long));
+    long *expected = malloc(count * sizeof(long));
+    assert(nums != NULL && target != NULL && expected != NULL);
+    srand(3650);
+    fill_halves();
+
+    double best = 1e9;
+    for (int run = 0; run < RUNS; run++) {
+        double start = now_secs();
+        merge(nums, 0, count / 2, count, expected);
+        double secs = now_secs() - start;
+        best = secs < best ? secs : best;
+    }
+    double serial = best;
+    printf("%-16s %10s %8s\n", "merge", "best (s)", "speedup");
+    printf("%-16s %10.3f %8.2f\n", "serial", serial, 1.0);
+
+    for (int threads = 1; ; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+        pool_t *pool = pool_create(threads);
+        best = 1e9;
+        for (int run = 0; run < RUNS; run++) {
+            memset(target, 0, count * sizeof(long));
+            task_t task = { merge_all, NULL, 0 };
+            double start = now_secs();
+            pool_run(pool, &task);
+            double secs = now_secs() - start;
+            best = secs < best ? secs : best;
+            assert(memcmp(target, expected, count * sizeof(long)) == 0);
+        }
+        pool_destroy(pool);
+
+        char name[32];
+        snprintf(name, sizeof(name), "parallel, %d", threads);
+        printf("%-16s %10.3f %8.2f\n", name, best, serial / best);
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    free(nums);
+    free(target);
+    free(expected);
+    return 0;
+}
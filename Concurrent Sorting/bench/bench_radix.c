@@ -0,0 +1,120 @@
+/**
+ * Radix Sort Benchmark
+ *
+ * Sorts count numbers (default 100M, the size of the experiments.md
+ * dataset) with the single-threaded merge sort of msort and tmsort, using
+ * the fastest merge kernel, and with radix_sort on 1, 2, 4, ... up to
+ * max_threads threads (default: the number of cores). Two inputs: a shuffle
+ * of 1 to count, like the output of `numbers`, and random 64-bit numbers of
+ * both signs. Prints the best of three runs and checks every result.
+ *
+ * Usage: bench/bench_radix [count] [max_threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <assert.h>
+#include <unistd.h>
+
+#include "merge.h"
+#include "radix.h"
+#include "smallsort.h"
+
+#define RUNS 3
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * The recursion of msort: sorts nums[from, to) into target
+ */
+static void merge_sort_aux(long nums[], int from, int to, long target[]) {
+    if (to - from <= sort_cutoff) {
+        insertion_sort(target, from, to);
+        return;
+    }
+
+    int mid = (from + to) / 2;
+    merge_sort_aux(target, from, mid, nums);
+    merge_sort_aux(target, mid, to, nums);
+    merge(nums, from, mid, to, target);
+}
+
+static void check_sorted(const long *nums, int count) {
+    for (int i = 1; i < count; i++) {
+        assert(nums[i - 1] <= nums[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000000;
+    int max_threads = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+    const char *kernel = use_merge_kernel(NULL);
+
+    long *input = malloc(count * sizeof(long));
+    long *nums = malloc(count * sizeof(long));
+    long *target = malloc(count * sizeof(long));
+    assert(input != NULL && nums != NULL && target != NULL);
+
+    printf("%-10s %-20s %10s\n", "input", "sort", "best (s)");
+    for (int signed_input = 0; signed_input <= 1; signed_input++) {
+        const char *name = signed_input ? "random" : "numbers";
+        srand(3650);
+        for (int i = 0; i < count; i++) {
+            input[i] = signed_input ? (long)(((unsigned long)rand() << 33) ^ ((unsigned long)rand() << 11) ^ rand()) : i + 1;
+        }
+        if (!signed_input) {
+            for (int i = count - 1; i > 0; i--) {
+                int j = (((long)rand() << 31) ^ rand()) % (i + 1);
+                long swap = input[i];
+                input[i] = input[j];
+                input[j] = swap;
+            }
+        }
+
+        double best = 1e9;
+        for (int run = 0; run < RUNS; run++) {
+            memcpy(nums, input, count * sizeof(long));
+            memcpy(target, input, count * sizeof(long));
+            double start = now_secs();
+            merge_sort_aux(nums, 0, count, target);
+            double secs = now_secs() - start;
+            best = secs < best ? secs : best;
+            check_sorted(target, count);
+        }
+        char sort[32];
+        snprintf(sort, sizeof(sort), "merge (%s)", kernel);
+        printf("%-10s %-20s %10.3f\n", name, sort, best);
+
+        for (int threads = 1; ; threads *= 2) {
+            if (threads > max_threads) {
+                threads = max_threads;
+            }
+            best = 1e9;
+            for (int run = 0; run < RUNS; run++) {
+                memcpy(nums, input, count * sizeof(long));
+                double start = now_secs();
+                long *sorted = radix_sort(nums, count, threads);
+                double secs = now_secs() - start;
+                best = secs < best ? secs : best;
+                check_sorted(sorted, count);
+                free(sorted);
+            }
+            snprintf(sort, sizeof(sort), "radix, %d thread%s", threads, threads == 1 ? "" : "s");
+            printf("%-10s %-20s %10.3f\n", name, sort, best);
+            if (threads == max_threads) {
+                break;
+            }
+        }
+    }
+
+    free(input);
+    free(nums);
+    free(target);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#!/usr/bin/env bash
+#
+# Scaling benchmark: sorting time of tmsort with 1 up to N threads.
+#
+# usage: ./bench_scaling.sh [count] [max_threads] [runs]
+#
+# Sorts count random numbers (default 100000000, the dataset of
+# experiments.md) with MSORT_THREADS=1, 2, 4, ... up to max_threads (default:
+# the number of cores), runs times each (default 3), and prints the best
+# sorting time and the speedup over one thread. The input is generated once
+# and kept in $TMPDIR for later runs.
+
+count=${1:-100000000}
+max=${2:-$(nproc)}
+runs=${3:-3}
+
+dir=$(cd "$(dirname "$0")" && pwd)
+input=${TMPDIR:-/tmp}/tmsort-$count.txt
+
+if [ ! -f "$input" ]; then
+  echo "Generating $count numbers into $input"
+  bash "$dir/numbers" 1 "$count" > "$input"
+fi
+
+threads=""
+for ((t = 1; t < max; t *= 2)); do
+  threads="$threads $t"
+done
+threads="$threads $max"
+
+printf "%8s %12s %8s\n" threads "best (s)" speedup
+base=""
+for t in $threads; do
+  best=""
+  for ((r = 0; r < runs; r++)); do
+    secs=$(MSORT_THREADS=$t "$dir/tmsort" "$input" 2>&1 >/dev/null |
+           sed -n 's/^Sorting completed in \([0-9.]*\) seconds.*/\1/p')
+    if [ -z "$best" ] || awk "BEGIN { exit !($secs < $best) }"; then
+      best=$secs
+    fi
+  done
+  base=${base:-$best}
+  printf "%8d %12.3f %8.2f\n" "$t" "$best" "$(awk "BEGIN { print $base / $best }")"
+done
@@ -0,0 +1,341 @@
+/**
+ * Merging of Sorted Slices
+ *
+ * The parallel merge splits the output in half over and over. For an output
+ * position k, the co-rank is the number i of elements that the first k
+ * outputs take from the left slice; the other k - i come from the right
+ * one. It is found by binary search, after which both halves of the output
+ * can be merged independently.
+ *
+ * Every merge runs one of several kernels, picked at startup by CPU
+ * features. The branchy loop mispredicts about every other comparison on
+ * random input; the branchless one turns the comparison into data; the
+ * AVX2 and AVX-512 ones merge 4 or 8 elements per step with a bitonic
+ * network.
+ */
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "merge.h"
+#include "pool.h"
+
+// Merges with fewer outputs than this are not split further
+#define MIN_MERGE_TASK (1 << 16)
+
+// Arguments of a merge task: merge a[0, a_count) and b[0, b_count) into out
+typedef struct {
+    const long *a;
+    int a_count;
+    const long *b;
+    int b_count;
+    long *out;
+} MergeArgs;
+
+/**
+ * Merge two sorted runs into out, branching on every comparison
+ */
+static void merge_branchy(const long *a, int a_count, const long *b, int b_count, long *out) {
+    int left = 0;
+    int right = 0;
+
+    int i = 0;
+    // Compare elements from both runs and copy smaller one
+    for (; left < a_count && right < b_count; i++) {
+        if (a[left] <= b[right]) {
+            out[i] = a[left];
+            left++;
+        }
+        else {
+            out[i] = b[right];
+            right++;
+        }
+    }
+
+    // Copy any remaining elements
+    if (left < a_count) {
+        memmove(&out[i], &a[left], (a_count - left) * sizeof(long));
+    }
+    else if (right < b_count) {
+        memmove(&out[i], &b[right], (b_count - right) * sizeof(long));
+    }
+}
+
+/**
+ * Merge two sorted runs into out without a data-dependent branch: the
+ * comparison selects the element with a conditional move and advances one
+ * of the indexes by arithmetic
+ */
+static void merge_branchless(const long *a, int a_count, const long *b, int b_count, long *out) {
+    int left = 0;
+    int right = 0;
+
+    int i = 0;
+    for (; left < a_count && right < b_count; i++) {
+        long x = a[left];
+        long y = b[right];
+        int take_left = x <= y;
+        out[i] = take_left ? x : y;
+        left += take_left;
+        right += 1 - take_left;
+    }
+
+    if (left < a_count) {
+        memmove(&out[i], &a[left], (a_count - left) * sizeof(long));
+    }
+    else if (right < b_count) {
+        memmove(&out[i], &b[right], (b_count - right) * sizeof(long));
+    }
+}
+
+/**
+ * Finish a vector merge: merge the sorted block the registers still hold
+ * with what is left of the run that has less than a block, then merge the
+ * result with the rest of the other run
+ */
+static void merge_tail(const long *block, int block_count,
+                       const long *a, int a_count, const long *b, int b_count, long *out) {
+    long small[16];
+    if (a_count > b_count) {
+        const long *rest = a;
+        int rest_count = a_count;
+        a = b;
+        a_count = b_count;
+        b = rest;
+        b_count = rest_count;
+    }
+    merge_branchless(block, block_count, a, a_count, small);
+    merge_branchless(small, block_count + a_count, b, b_count, out);
+}
+
+/**
+ * AVX2: minimum and maximum of each lane of two vectors of 4 longs
+ */
+__attribute__((target("avx2")))
+static inline void minmax4(__m256i x, __m256i y, __m256i *low, __m256i *high) {
+    __m256i greater = _mm256_cmpgt_epi64(x, y);
+    *low = _mm256_blendv_epi8(x, y, greater);
+    *high = _mm256_blendv_epi8(y, x, greater);
+}
+
+/**
+ * AVX2: sort the lanes of a bitonic vector of 4 longs. Lanes 2 and 3 take
+ * the maxima of the distance 2 pairs, lanes 1 and 3 those of distance 1
+ */
+__attribute__((target("avx2")))
+static inline __m256i bitonic_sort4(__m256i v) {
+    __m256i low, high;
+    minmax4(v, _mm256_permute4x64_epi64(v, 0x4E), &low, &high);
+    v = _mm256_blend_epi32(low, high, 0xF0);
+    minmax4(v, _mm256_permute4x64_epi64(v, 0xB1), &low, &high);
+    return _mm256_blend_epi32(low, high, 0xCC);
+}
+
+/**
+ * AVX2 bitonic merge kernel: the registers hold the next 4 outputs and the
+ * 4 elements that follow them. Each step merges the held 4 with the next 4
+ * of the run whose next element is smaller, and writes out the lower half
+ */
+__attribute__((target("avx2")))
+static void merge_avx2(const long *a, int a_count, const long *b, int b_count, long *out) {
+    if (a_count < 4 || b_count < 4) {
+        merge_branchless(a, a_count, b, b_count, out);
+        return;
+    }
+
+    __m256i low = _mm256_loadu_si256((const __m256i *)a);
+    __m256i high = _mm256_loadu_si256((const __m256i *)b);
+    int left = 4;
+    int right = 4;
+    for (;;) {
+        // a sorted vector and a reversed one form a bitonic sequence
+        minmax4(low, _mm256_permute4x64_epi64(high, 0x1B), &low, &high);
+        low = bitonic_sort4(low);
+        high = bitonic_sort4(high);
+        _mm256_storeu_si256((__m256i *)out, low);
+        out += 4;
+
+        if (left + 4 > a_count || right + 4 > b_count) {
+            break;
+        }
+        if (a[left] <= b[right]) {
+            low = _mm256_loadu_si256((const __m256i *)&a[left]);
+            left += 4;
+        }
+        else {
+            low = _mm256_loadu_si256((const __m256i *)&b[right]);
+            right += 4;
+        }
+    }
+
+    long block[4];
+    _mm256_storeu_si256((__m256i *)block, high);
+    merge_tail(block, 4, &a[left], a_count - left, &b[right], b_count - right, out);
+}
+
+/**
+ * AVX-512: sort the lanes of a bitonic vector of 8 longs, pairing lanes at
+ * distance 4, 2 and 1
+ */
+__attribute__((target("avx512f")))
+static inline __m512i bitonic_sort8(__m512i v) {
+    const __m512i distance4 = _mm512_set_epi64(3, 2, 1, 0, 7, 6, 5, 4);
+    const __m512i distance2 = _mm512_set_epi64(5, 4, 7, 6, 1, 0, 3, 2);
+    const __m512i distance1 = _mm512_set_epi64(6, 7, 4, 5, 2, 3, 0, 1);
+
+    __m512i other = _mm512_permutexvar_epi64(distance4, v);
+    v = _mm512_mask_blend_epi64(0xF0, _mm512_min_epi64(v, other), _mm512_max_epi64(v, other));
+    other = _mm512_permutexvar_epi64(distance2, v);
+    v = _mm512_mask_blend_epi64(0xCC, _mm512_min_epi64(v, other), _mm512_max_epi64(v, other));
+    other = _mm512_permutexvar_epi64(distance1, v);
+    return _mm512_mask_blend_epi64(0xAA, _mm512_min_epi64(v, other), _mm512_max_epi64(v, other));
+}
+
+/**
+ * AVX-512 bitonic merge kernel, as merge_avx2 with blocks of 8
+ */
+__attribute__((target("avx512f")))
+static void merge_avx512(const long *a, int a_count, const long *b, int b_count, long *out) {
+    if (a_count < 8 || b_count < 8) {
+        merge_branchless(a, a_count, b, b_count, out);
+        return;
+    }
+
+    const __m512i reverse = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    __m512i low = _mm512_loadu_si512(a);
+    __m512i high = _mm512_loadu_si512(b);
+    int left = 8;
+    int right = 8;
+    for (;;) {
+        __m512i reversed = _mm512_permutexvar_epi64(reverse, high);
+        high = _mm512_max_epi64(low, reversed);
+        low = _mm512_min_epi64(low, reversed);
+        low = bitonic_sort8(low);
+        high = bitonic_sort8(high);
+        _mm512_storeu_si512(out, low);
+        out += 8;
+
+        if (left + 8 > a_count || right + 8 > b_count) {
+            break;
+        }
+        if (a[left] <= b[right]) {
+            low = _mm512_loadu_si512(&a[left]);
+            left += 8;
+        }
+        else {
+            low = _mm512_loadu_si512(&b[right]);
+            right += 8;
+        }
+    }
+
+    long block[8];
+    _mm512_storeu_si512(block, high);
+    merge_tail(block, 8, &a[left], a_count - left, &b[right], b_count - right, out);
+}
+
+static int always_supported(void) {
+    return 1;
+}
+
+static int avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+static int avx512_supported(void) {
+    return __builtin_cpu_supports("avx512f");
+}
+
+// All kernels, slowest first
+static const struct {
+    const char *name;
+    merge_kernel_t *run;
+    int (*supported)(void);
+} kernels[] = {
+    { "branchy", merge_branchy, always_supported },
+    { "branchless", merge_branchless, always_supported },
+    { "avx2", merge_avx2, avx2_supported },
+    { "avx512", merge_avx512, avx512_supported },
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+// The kernel every merge uses
+static merge_kernel_t *merge_runs = merge_branchless;
+
+merge_kernel_t *find_merge_kernel(const char *name) {
+    for (size_t i = 0; i < KERNEL_COUNT; i++) {
+        if (strcmp(kernels[i].name, name) == 0) {
+            return kernels[i].supported() ? kernels[i].run : NULL;
+        }
+    }
+    return NULL;
+}
+
+const char *use_merge_kernel(const char *name) {
+    if (name != NULL && *name == '\0') {
+        name = NULL;
+    }
+    const char *used = NULL;
+    for (size_t i = 0; i < KERNEL_COUNT; i++) {
+        int wanted = name != NULL ? strcmp(kernels[i].name, name) == 0 : 1;
+        if (wanted && kernels[i].supported()) {
+            merge_runs = kernels[i].run;
+            used = kernels[i].name;
+        }
+    }
+    return used;
+}
+
+void merge(long nums[], int from, int mid, int to, long target[]) {
+    merge_runs(&nums[from], mid - from, &nums[mid], to - mid, &target[from]);
+}
+
+/**
+ * Number of elements of a among the first k outputs of merging a and b.
+ * Ties go to a, as in merge_runs
+ */
+static int co_rank(int k, const long *a, int a_count, const long *b, int b_count) {
+    int low = k > b_count ? k - b_count : 0;
+    int high = k < a_count ? k : a_count;
+    while (low < high) {
+        int i = low + (high - low) / 2;
+        // a[i] is among the first k if it does not come after b[k - i - 1]
+        if (a[i] <= b[k - i - 1]) {
+            low = i + 1;
+        }
+        else {
+            high = i;
+        }
+    }
+    return low;
+}
+
+/**
+ * Task entry point - merges its runs, splitting off the first half of the
+ * output as a task while it is large
+ */
+static void merge_task(void *args) {
+    MergeArgs *arg = (MergeArgs *)args;
+    int total = arg->a_count + arg->b_count;
+    if (total < MIN_MERGE_TASK) {
+        merge_runs(arg->a, arg->a_count, arg->b, arg->b_count, arg->out);
+        return;
+    }
+
+    int k = total / 2;
+    int i = co_rank(k, arg->a, arg->a_count, arg->b, arg->b_count);
+    MergeArgs first_args = { arg->a, i, arg->b, k - i, arg->out };
+    MergeArgs second_args = {
+        arg->a + i, arg->a_count - i, arg->b + (k - i), arg->b_count - (k - i), arg->out + k
+    };
+
+    task_t first = { merge_task, &first_args, 0 };
+    pool_spawn(&first);
+    merge_task(&second_args);
+    pool_wait(&first);
+}
+
+void parallel_merge(long nums[], int from, int mid, int to, long target[]) {
+    MergeArgs args = { &nums[from], mid - from, &nums[mid], to - mid, &target[from] };
+    merge_task(&args);
+}
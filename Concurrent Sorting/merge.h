@@ -0,0 +1,40 @@
+#pragma once
+
+/**
+ * Merging of Sorted Slices
+ *
+ * Both functions merge nums[from, mid) and nums[mid, to) into
+ * target[from, to). The scalar kernels keep equal elements in order, left
+ * slice first; the SIMD ones may swap them, which changes nothing for longs.
+ */
+
+/**
+ * A merge kernel: merges a[0, a_count) and b[0, b_count) into out
+ */
+typedef void merge_kernel_t(const long *a, int a_count, const long *b, int b_count, long *out);
+
+/**
+ * The kernel with the given name ("branchy", "branchless", "avx2" or
+ * "avx512"), or NULL if there is none or the CPU lacks its instructions
+ */
+merge_kernel_t *find_merge_kernel(const char *name);
+
+/**
+ * Make all merges use the named kernel or, for NULL or "", the fastest one
+ * the CPU supports. Returns the name of the kernel used, or NULL (and
+ * changes nothing) if the named kernel is unknown or unsupported. Until the
+ * first call, merges use the branchless kernel.
+ */
+const char *use_merge_kernel(const char *name);
+
+/**
+ * Merge on the calling thread
+ */
+void merge(long nums[], int from, int mid, int to, long target[]);
+
+/**
+ * Merge with all workers of the current pool (see pool.h). The output is
+ * cut into pieces whose inputs are found by binary search (merge path), so
+ * the pieces are independent tasks. Outside of a pool this is merge.
+ */
+void parallel_merge(long nums[], int from, int mid, int to, long target[]);
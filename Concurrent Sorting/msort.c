@@ -11,6 +11,7 @@
 
 #include <assert.h>
 
+#include "smallsort.h"
 #include "timing.h"
 
 #define tty_printf(...) (isatty(1) && isatty(0) ? printf(__VA_ARGS__) : 0)
@@ -67,7 +68,8 @@ void merge(long nums[], int from, int mid, int to, long target[]) {
  * Warning: nums gets overwritten.
  */
 void merge_sort_aux(long nums[], int from, int to, long target[]) {
-  if (to - from <= 1) {
+  if (to - from <= sort_cutoff) {
+    insertion_sort(target, from, to);
     return;
   }
 
@@ -150,6 +152,10 @@ int main(int argc, char **argv) {
   // get the number of threads from the environment variable SORT_THREADS
   if (getenv("MSORT_THREADS") != NULL)
     thread_count = atoi(getenv("MSORT_THREADS"));
+  if (getenv("MSORT_CUTOFF") != NULL)
+    sort_cutoff = atoi(getenv("MSORT_CUTOFF"));
+  if (sort_cutoff < 1)
+    sort_cutoff = 1;
 
   log("Running with %d thread(s). Reading input.\n", thread_count);
 
@@ -0,0 +1,261 @@
+/**
+ * Work-Stealing Thread Pool
+ *
+ * Every worker owns a fixed-size ring of task pointers guarded by a mutex.
+ * Tasks are coarse (whole subtrees of the sort), so the lock is taken rarely
+ * and is almost never contended. Workers with nothing to do sleep on a
+ * condition variable until a task is spawned. A worker waiting for a stolen
+ * task with nothing left to help with sleeps there too, after a short spin,
+ * until the thief finishes.
+ */
+#include <stdlib.h>
+
+#include <assert.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+#define DEQUE_SIZE 256
+
+// Times pool_wait looks for the task to finish or for other work before it
+// sleeps
+#define WAIT_SPINS 100
+
+typedef struct {
+    pthread_mutex_t lock;
+    task_t *tasks[DEQUE_SIZE];
+    int head;   // oldest task, taken by thieves
+    int count;  // tasks in the deque; the newest is popped by the owner
+} deque_t;
+
+typedef struct {
+    pool_t *pool;
+    int id;
+    pthread_t thread;
+    deque_t deque;
+} worker_t;
+
+struct pool {
+    int size;
+    worker_t *workers;
+    int pending;    // tasks in all deques
+    int sleeping;   // workers waiting for tasks
+    int waiting;    // ... of them waiting for a stolen task to finish
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+// The worker running on this thread, NULL outside of the pool
+static __thread worker_t *self = NULL;
+
+/**
+ * Take the newest task of the worker's own deque
+ */
+static task_t *pop(worker_t *worker) {
+    deque_t *deque = &worker->deque;
+    task_t *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        deque->count--;
+        task = deque->tasks[(deque->head + deque->count) % DEQUE_SIZE];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/**
+ * Take the oldest task of another worker's deque
+ */
+static task_t *steal(worker_t *victim) {
+    deque_t *deque = &victim->deque;
+    task_t *task = NULL;
+    if (__atomic_load_n(&deque->count, __ATOMIC_RELAXED) == 0) {
+        return NULL;  // don't take the lock of an idle worker
+    }
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        task = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) % DEQUE_SIZE;
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/**
+ * Find a task for the worker: its own newest first, then the oldest of the
+ * others, starting with the next worker
+ */
+static task_t *find_task(worker_t *worker) {
+    pool_t *pool = worker->pool;
+    if (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0) {
+        return NULL;
+    }
+    task_t *task = pop(worker);
+    for (int i = 1; task == NULL && i < pool->size; i++) {
+        task = steal(&pool->workers[(worker->id + i) % pool->size]);
+    }
+    if (task != NULL) {
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    }
+    return task;
+}
+
+static void execute(task_t *task) {
+    task->run(task->arg);
+    __atomic_store_n(&task->done, 1, __ATOMIC_SEQ_CST);
+
+    // Wake whoever sleeps in pool_wait, maybe for this task. As for
+    // sleeping, a waiter either sees done or we see it waiting
+    worker_t *worker = self;
+    if (worker != NULL && __atomic_load_n(&worker->pool->waiting, __ATOMIC_SEQ_CST) > 0) {
+        pool_t *pool = worker->pool;
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/**
+ * Worker thread entry point - runs and steals tasks until the pool stops
+ */
+static void *worker_main(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+    pool_t *pool = worker->pool;
+    self = worker;
+
+    for (;;) {
+        task_t *task = find_task(worker);
+        if (task != NULL) {
+            execute(task);
+            continue;
+        }
+
+        // Sleep until a task is spawned. Announcing ourselves before
+        // checking pending means a spawner either sees us or we see its task
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        __atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        int stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+pool_t *pool_create(int threads) {
+    assert(threads >= 1);
+    pool_t *pool = calloc(1, sizeof(pool_t));
+    assert(pool != NULL);
+    pool->size = threads;
+    pool->workers = calloc(threads, sizeof(worker_t));
+    assert(pool->workers != NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        pthread_mutex_init(&pool->workers[i].deque.lock, NULL);
+    }
+    // Worker 0 is whoever calls pool_run
+    for (int i = 1; i < threads; i++) {
+        int rc = pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]);
+        assert(rc == 0);
+    }
+    return pool;
+}
+
+void pool_run(pool_t *pool, task_t *task) {
+    worker_t *outer = self;
+    self = &pool->workers[0];
+    execute(task);
+    self = outer;
+}
+
+void pool_spawn(task_t *task) {
+    task->done = 0;
+    worker_t *worker = self;
+    if (worker == NULL) {
+        execute(task);
+        return;
+    }
+
+    // Count the task before it can be stolen, so pending never drops below 0
+    pool_t *pool = worker->pool;
+    deque_t *deque = &worker->deque;
+    pthread_mutex_lock(&deque->lock);
+    int full = deque->count == DEQUE_SIZE;
+    if (!full) {
+        __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+        deque->tasks[(deque->head + deque->count) % DEQUE_SIZE] = task;
+        deque->count++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    if (full) {
+        execute(task);
+        return;
+    }
+
+    if (__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void pool_wait(task_t *task) {
+    worker_t *worker = self;
+    int spins = 0;
+    while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        // Our own newest task is the one we wait for unless it was stolen;
+        // after that, help with whatever is left while the thief finishes
+        task_t *other = worker != NULL ? find_task(worker) : NULL;
+        if (other != NULL) {
+            execute(other);
+            spins = 0;
+            continue;
+        }
+        if (worker == NULL || ++spins < WAIT_SPINS) {
+            continue;
+        }
+
+        // Sleep until the thief is done or there is another task to help
+        // with, rather than take the time slice the thief may need
+        pool_t *pool = worker->pool;
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&pool->waiting, 1, __ATOMIC_SEQ_CST);
+        while (!__atomic_load_n(&task->done, __ATOMIC_SEQ_CST) &&
+               __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        __atomic_sub_fetch(&pool->waiting, 1, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->lock);
+        spins = 0;
+    }
+}
+
+void pool_destroy(pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->size; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->size; i++) {
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    free(pool->workers);
+    free(pool);
+}
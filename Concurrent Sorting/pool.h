@@ -0,0 +1,52 @@
+#pragma once
+
+/**
+ * Work-Stealing Thread Pool
+ *
+ * A fixed set of workers, each with its own deque of tasks. A worker pushes
+ * and pops tasks at the back of its own deque and, when that is empty,
+ * steals from the front of another worker's deque, so idle workers pick up
+ * the largest pending subproblems. Tasks live in the stack frame that
+ * spawns them and must be waited for before that frame returns.
+ */
+
+/**
+ * A unit of work: run(arg). done is set once run has returned.
+ */
+typedef struct task {
+    void (*run)(void *arg);
+    void *arg;
+    int done;
+} task_t;
+
+typedef struct pool pool_t;
+
+/**
+ * Create a pool of the given number of workers. The thread that calls
+ * pool_run is one of them, so threads - 1 threads are started.
+ */
+pool_t *pool_create(int threads);
+
+/**
+ * Run task on the calling thread as a worker of the pool and return when
+ * it and everything it spawned are done.
+ */
+void pool_run(pool_t *pool, task_t *task);
+
+/**
+ * Make task available to other workers. The caller must pool_wait for it.
+ * Outside of pool_run, or when the deque is full, the task runs at once.
+ */
+void pool_spawn(task_t *task);
+
+/**
+ * Wait for a spawned task. Runs the task itself if nobody stole it, and
+ * runs other pending tasks while a thief is still busy with it. With none
+ * left, it sleeps until the thief is done.
+ */
+void pool_wait(task_t *task);
+
+/**
+ * Stop the workers and free the pool.
+ */
+void pool_destroy(pool_t *pool);
@@ -0,0 +1,18 @@
+#pragma once
+
+/**
+ * Parallel LSD Radix Sort
+ *
+ * Sorts 64-bit longs by 11-bit digits, least significant first, in up to 6
+ * stable counting passes. Negative numbers sort before positive ones.
+ */
+
+/**
+ * Sort the given array with the given number of threads and return the
+ * sorted version.
+ *
+ * The result is malloc'd so it is the caller's responsibility to free it.
+ *
+ * Warning: The source array gets overwritten.
+ */
+long *radix_sort(long nums[], int count, int threads);
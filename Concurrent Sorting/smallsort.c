@@ -0,0 +1,19 @@
+/**
+ * Sorting of Small Slices
+ */
+#include "smallsort.h"
+
+int sort_cutoff = DEFAULT_CUTOFF;
+
+void insertion_sort(long nums[], int from, int to) {
+    for (int i = from + 1; i < to; i++) {
+        long value = nums[i];
+        int j = i;
+        // Shift the larger elements of the sorted prefix one slot right
+        while (j > from && nums[j - 1] > value) {
+            nums[j] = nums[j - 1];
+            j--;
+        }
+        nums[j] = value;
+    }
+}
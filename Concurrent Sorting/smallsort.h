@@ -0,0 +1,20 @@
+#pragma once
+
+/**
+ * Sorting of Small Slices
+ *
+ * Merge sort stops splitting slices of at most sort_cutoff elements and
+ * insertion sorts them instead, which saves the calls and merges of the
+ * last few recursion levels.
+ */
+
+/** Default cutoff, the middle of the 8-128 range bench/bench_cutoff found equivalent */
+#define DEFAULT_CUTOFF 32
+
+/** Slices of at most this many elements are insertion sorted (MSORT_CUTOFF) */
+extern int sort_cutoff;
+
+/**
+ * Sort nums[from, to) in place. Equal elements keep their order.
+ */
+void insertion_sort(long nums[], int from, int to);
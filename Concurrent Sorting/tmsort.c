@@ -2,7 +2,9 @@
  * Threaded Merge Sort
  *
  * Multi-threaded merge sort using POSIX threads. Reads MSORT_THREADS environment
- * variable to limit concurrent threads and uses mutex to prevent race conditions.
+ * variable to limit concurrent threads and runs the recursion as fork/join tasks
+ * on a work-stealing pool of that many threads. Large merges are split among the
+ * threads as well.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,6 +17,11 @@
 #include <assert.h>
 #include <pthread.h>
 
+#include "merge.h"
+#include "pool.h"
+#include "radix.h"
+#include "smallsort.h"
+
 #define tty_printf(...) (isatty(1) && isatty(0) ? printf(__VA_ARGS__) : 0)
 
 #ifndef SHUSH
@@ -23,15 +30,16 @@
 #define log(...)
 #endif
 
+// Slices smaller than this are sorted by the thread that reaches them
+#define MIN_TASK_SIZE (1 << 14)
+
 // Global variables for thread control
 int thread_count = 1;  // max threads allowed (from MSORT_THREADS env var)
-int num_threads = 1;   // current active threads
-pthread_mutex_t thread_count_mutex = PTHREAD_MUTEX_INITIALIZER;  // protects num_threads
+pool_t *pool = NULL;   // workers sharing the sort, NULL with one thread
 
 void merge_sort_aux(long nums[], int from, int to, long target[]);
 
-// Arguments passed to worker threads
-// Must be heap-allocated to avoid stack lifetime issues
+// Arguments of a sort task, kept in the frame that spawns it
 typedef struct {
     long *arr;
     long *temp;
@@ -58,95 +66,45 @@ void print_long_array(const long *array, int count) {
 }
 
 /**
- * Merge two sorted slices into target array
+ * Task entry point - sorts its assigned slice
  */
-void merge(long nums[], int from, int mid, int to, long target[]) {
-    int left = from;
-    int right = mid;
-
-    int i = from;
-    // Compare elements from both slices and copy smaller one
-    for (; i < to && left < mid && right < to; i++) {
-        if (nums[left] <= nums[right]) {
-            target[i] = nums[left];
-            left++;
-        }
-        else {
-            target[i] = nums[right];
-            right++;
-        }
-    }
-    
-    // Copy any remaining elements
-    if (left < mid) {
-        memmove(&target[i], &nums[left], (mid - left) * sizeof(long));
-    }
-    else if (right < to) {
-        memmove(&target[i], &nums[right], (to - right) * sizeof(long));
-    }
-}
-
-/**
- * Worker thread entry point - sorts its assigned slice then frees arguments
- */
-void *merge_sort_thread(void *args) {
+void merge_sort_task(void *args) {
     ThreadArgs *arg = (ThreadArgs *)args;
     merge_sort_aux(arg->arr, arg->left, arg->right, arg->temp);
-    free(arg);  // free heap allocation
-    return NULL;
 }
 
 /**
- * Recursively sort slice using threads when available
+ * Recursively sort slice, offering the left half to idle workers
  * Note: nums and target swap roles at each recursion level
  */
 void merge_sort_aux(long nums[], int from, int to, long target[]) {
-    if (to - from <= 1) {
-        return;  // base case: already sorted
+    if (to - from <= sort_cutoff) {
+        insertion_sort(target, from, to);  // base case: small slice
+        return;
     }
 
     int mid = (from + to) / 2;
-    pthread_t left_thread;
-    int left_created = 0;
-
-    // Try to spawn thread for left half if we have threads available
-    pthread_mutex_lock(&thread_count_mutex);
-    if (num_threads < thread_count) {
-        num_threads++;
-        pthread_mutex_unlock(&thread_count_mutex);
-        
-        // Allocate on heap because thread may outlive this function call
-        ThreadArgs *left_args = malloc(sizeof(ThreadArgs));
-        assert(left_args != NULL);
-        left_args->arr = target;  // arrays swap for next level
-        left_args->temp = nums;
-        left_args->left = from;
-        left_args->right = mid;
-        
-        pthread_create(&left_thread, NULL, merge_sort_thread, left_args);
-        left_created = 1;
-    }
-    else {
-        pthread_mutex_unlock(&thread_count_mutex);
-    }
 
-    // Current thread does right half
-    merge_sort_aux(target, mid, to, nums);
-    
-    if (!left_created) {
-        // No thread spawned, do left half here
-        merge_sort_aux(target, from, mid, nums);
+    if (pool != NULL && to - from >= MIN_TASK_SIZE) {
+        // Another worker may steal the left half while we do the right half
+        ThreadArgs left_args = { target, nums, from, mid };  // arrays swap for next level
+        task_t left = { merge_sort_task, &left_args, 0 };
+        pool_spawn(&left);
+        merge_sort_aux(target, mid, to, nums);
+
+        // Runs the left half here if nobody took it
+        pool_wait(&left);
+
+        // Both halves sorted, idle workers can take pieces of the merge
+        parallel_merge(nums, from, mid, to, target);
     }
     else {
-        // Wait for left thread to finish
-        pthread_join(left_thread, NULL);
-        pthread_mutex_lock(&thread_count_mutex);
-        num_threads--;  // free up thread slot
-        pthread_mutex_unlock(&thread_count_mutex);
-    }
+        merge_sort_aux(target, from, mid, nums);
+        merge_sort_aux(target, mid, to, nums);
 
-    // Both halves sorted, now merge them
-    merge(nums, from, mid, to, target);
+        // Both halves sorted, now merge them
+        merge(nums, from, mid, to, target);
+    }
 }
 
 /**
@@ -158,7 +116,17 @@ long *merge_sort(long nums[], int count) {
     assert(result != NULL);
 
     memmove(result, nums, count * sizeof(long));
-    merge_sort_aux(nums, 0, count, result);
+    if (thread_count > 1) {
+        pool = pool_create(thread_count);
+        ThreadArgs args = { nums, result, 0, count };
+        task_t root = { merge_sort_task, &args, 0 };
+        pool_run(pool, &root);
+        pool_destroy(pool);
+        pool = NULL;
+    }
+    else {
+        merge_sort_aux(nums, 0, count, result);
+    }
 
     return result;
 }
@@ -200,10 +168,25 @@ int allocate_load_array(int argc, char **argv, long **array) {
 }
 
 int main(int argc, char **argv) {
+    // Pick the algorithm, merge sort unless --algo=radix
+    int radix = 0;
+    if (argc > 1 && strncmp(argv[1], "--algo=", 7) == 0) {
+        if (strcmp(argv[1] + 7, "radix") == 0) {
+            radix = 1;
+        }
+        else if (strcmp(argv[1] + 7, "merge") != 0) {
+            fprintf(stderr, "Unknown algorithm %s\n", argv[1] + 7);
+            return 1;
+        }
+        argv[1] = argv[0];  // the file name becomes argv[1]
+        argc--;
+        argv++;
+    }
+
     if (argc > 1 && strcmp(argv[1], "--help") == 0) {
         fprintf(
             stderr, 
-            "Usage: %s <filename>\n\n"
+            "Usage: %s [--algo=merge|radix] <filename>\n\n"
             "The first line of the file should be a count followed by that many lines containing\n"
             "a single decimal integer.\n",
             argv[0]);
@@ -216,8 +199,26 @@ int main(int argc, char **argv) {
     if (getenv("MSORT_THREADS") != NULL) {
         thread_count = atoi(getenv("MSORT_THREADS"));
     }
+    if (getenv("MSORT_CUTOFF") != NULL) {
+        sort_cutoff = atoi(getenv("MSORT_CUTOFF"));
+    }
+    if (sort_cutoff < 1) {
+        sort_cutoff = 1;  // a single element is always sorted
+    }
 
-    log("Running with %d thread(s). Reading input.\n", thread_count);
+    // Merge with the fastest kernel of this CPU unless MSORT_MERGE names one
+    const char *kernel = use_merge_kernel(getenv("MSORT_MERGE"));
+    if (kernel == NULL) {
+        fprintf(stderr, "Unknown or unsupported merge kernel %s\n", getenv("MSORT_MERGE"));
+        return 1;
+    }
+
+    if (radix) {
+        log("Running radix sort with %d thread(s). Reading input.\n", thread_count);
+    }
+    else {
+        log("Running with %d thread(s) and the %s merge. Reading input.\n", thread_count, kernel);
+    }
 
     // Read input
     gettimeofday(&begin, 0);
@@ -230,7 +231,7 @@ int main(int argc, char **argv) {
 
     // Sort
     gettimeofday(&begin, 0);
-    long *result = merge_sort(array, count);
+    long *result = radix ? radix_sort(array, count, thread_count) : merge_sort(array, count);
     gettimeofday(&end, 0);
     
     log("Sorting completed in %f seconds.\n", time_in_secs(&begin, &end));